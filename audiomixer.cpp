@@ -0,0 +1,485 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Mixes several tone generators into one stream of samples.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QThread>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "audiomixer.h"
+#include "impairment.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/*!
+ * \brief Samples mixed in one go by \ref AudioMixer::readData()
+ */
+#define MIX_BLOCK 256
+
+
+/*!
+ * \brief Create a source, see \ref AudioMixer::addSource()
+ */
+MixerSource::MixerSource(int freq, float _level, float _pan)
+	: QObject(0)
+	, level(_level)
+	, pan(_pan)
+	, pendingMs(-1)
+	, pendingFreq(-1)
+	, pendingEnv(-1)
+{
+	gen = new SineSource(freq, this);
+}
+
+
+/*!
+ * \brief Change the pitch of this source
+ *
+ * Like all setters, this only hands the change over to the thread that
+ * mixes, it takes effect with the next mix.
+ */
+void MixerSource::setFreq(int freq)
+{
+	pendingFreq.fetchAndStoreOrdered(qMax(freq, 0));
+}
+
+
+/*!
+ * \brief Change the volume of this source
+ *
+ * @param _level  1.0 is full scale. With many sources, keep the sum of
+ *                all levels below 1.0, or the loud parts will clip.
+ */
+void MixerSource::setLevel(float _level)
+{
+	level = _level;
+}
+
+
+/*!
+ * \brief Place this source between left (-1.0) and right (1.0)
+ *
+ * This only has an effect on stereo sound cards.
+ */
+void MixerSource::setPan(float _pan)
+{
+	pan = qBound(-1.0f, _pan, 1.0f);
+}
+
+
+/*!
+ * \brief Change how tones rise and fall, see \ref SineSource::setEnvelope()
+ */
+void MixerSource::setEnvelope(SineSource::Envelope shape, float riseMs)
+{
+	// Both go into one int: the shape in the low 4 bits, above it the
+	// rise in 1/100 ms
+	int rise = qBound(0, (int)(riseMs * 100 + 0.5f), 0x7ffffff);
+	pendingEnv.fetchAndStoreOrdered(rise << 4 | shape);
+}
+
+
+/*!
+ * \brief Start a tone on this source
+ *
+ * The tone generator belongs to the thread that mixes, so the tone only
+ * gets handed over here. It starts with the next mix.
+ *
+ * @param ms  Desired sound duration in milliseconds.
+ */
+void MixerSource::playSound(unsigned int ms)
+{
+	MYTRACE("MixerSource::playSound(%d)", ms);
+
+	pendingMs.fetchAndStoreOrdered(qMin(ms, 0x7fffffffu));
+	emit sounding(ms);
+}
+
+
+/*!
+ * \brief Apply what the setters handed over, called by the mix
+ */
+void MixerSource::update()
+{
+	int freq = pendingFreq.fetchAndStoreOrdered(-1);
+	if (freq >= 0)
+		gen->setFreq(freq);
+	int env = pendingEnv.fetchAndStoreOrdered(-1);
+	if (env >= 0)
+		gen->setEnvelope((SineSource::Envelope)(env & 15), (env >> 4) / 100.0f);
+	int ms = pendingMs.fetchAndStoreOrdered(-1);
+	if (ms >= 0)
+		gen->setDuration(ms);
+}
+
+
+
+/*!
+ * \brief Mixer for many tone generators
+ *
+ * @param parent  QObject parent, if any
+ *
+ * Usage:
+ * \code
+ *   AudioMixer *mixer = new AudioMixer(this);
+ *   audioOutput->start(mixer);
+ *   MixerSource *station = mixer->addSource(650, 0.2, -0.5);
+ *   connect(morse, SIGNAL(playSound(unsigned int)), station, SLOT(playSound(unsigned int)) );
+ * \endcode
+ */
+AudioMixer::AudioMixer(QObject *parent)
+	: QIODevice(parent)
+	, rate(SAMPLE_RATE)
+	, channels(1)
+	, type(SineSource::Int16)
+	, chain(0)
+{
+	open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+
+/*!
+ * \brief Class destructor
+ *
+ * Deletes all sources that are still in the mixer.
+ */
+AudioMixer::~AudioMixer()
+{
+	for (int i = 0; i < maxSources; i++)
+		delete sources[i].fetchAndStoreOrdered(0);
+}
+
+
+/*!
+ * \brief Set the format of the mixed samples
+ *
+ * Takes the same arguments as \ref SineSource::setFormat(). The sources
+ * follow the sample rate.
+ */
+void AudioMixer::setFormat(int sampleRate, int chans, SineSource::SampleType sampleType)
+{
+	MYTRACE("AudioMixer::setFormat(%d, %d, %d)", sampleRate, chans, sampleType);
+
+	rate = sampleRate > 0 ? sampleRate : SAMPLE_RATE;
+	channels = qBound(1, chans, 2);
+	type = sampleType;
+	if (chain)
+		chain->setSampleRate(rate);
+	for (int i = 0; i < maxSources; i++) {
+		MixerSource *s = sources[i];
+		if (s)
+			s->gen->setFormat(rate, 1, SineSource::Int16);
+	}
+}
+
+
+/*!
+ * \brief Returns the size of one sample frame (all channels) in bytes
+ */
+int AudioMixer::frameBytes() const
+{
+	return channels * (type == SineSource::Int16 ? 2 : 4);
+}
+
+
+/*!
+ * \brief Returns the sample rate, see \ref setFormat()
+ */
+int AudioMixer::sampleRate() const
+{
+	return rate;
+}
+
+
+/*!
+ * \brief Add a new source to the mix
+ *
+ * This can be called from any thread, even while the sound card reads.
+ *
+ * @param freq   pitch in Hz
+ * @param level  volume, 1.0 is full scale
+ * @param pan    -1.0 is left, 0 is center, 1.0 is right
+ * @returns      the new source, or 0 if there are already
+ *               \ref maxSources sources
+ */
+MixerSource *AudioMixer::addSource(int freq, float level, float pan)
+{
+	MYTRACE("AudioMixer::addSource(%d, %f, %f)", freq, level, pan);
+
+	MixerSource *s = new MixerSource(freq, level, qBound(-1.0f, pan, 1.0f));
+	s->gen->setFormat(rate, 1, SineSource::Int16);
+	for (int i = 0; i < maxSources; i++) {
+		if (sources[i].testAndSetOrdered(0, s))
+			return s;
+	}
+	qWarning("AudioMixer: more than %d sources", maxSources);
+	delete s;
+	return 0;
+}
+
+
+/*!
+ * \brief Remove a source from the mix and delete it
+ *
+ * This can be called from any thread. If the sound card is just mixing,
+ * this waits until it's done, which is less than a millisecond.
+ */
+void AudioMixer::removeSource(MixerSource *s)
+{
+	MYTRACE("AudioMixer::removeSource(%p)", s);
+
+	for (int i = 0; i < maxSources; i++) {
+		if (!sources[i].testAndSetOrdered(s, 0))
+			continue;
+
+		// A mix that started before might still use it, later ones
+		// can't find it anymore
+		int g = generation;
+		if (g & 1) {
+			while (generation == g)
+				QThread::yieldCurrentThread();
+		}
+		delete s;
+		return;
+	}
+}
+
+
+/*!
+ * \brief Returns how long the longest tone still sounds
+ *
+ * 0 means that the mixer only delivers silence.
+ */
+int AudioMixer::remainingMs() const
+{
+	int n = 0;
+	for (int i = 0; i < maxSources; i++) {
+		MixerSource *s = sources[i];
+		if (!s)
+			continue;
+		int ms = s->pendingMs;
+		if (ms >= 0)
+			n = qMax(n, (int)((qint64)ms * rate / 1000));
+		n = qMax(n, s->gen->remainingSamples());
+	}
+	return (int)((qint64)n * 1000 / rate);
+}
+
+
+/*!
+ * \brief Run the mix through \a chain, e.g. to add noise and fading
+ *
+ * Then the mix is handled like the mono audio of a receiver: it goes
+ * through the chain once and then to all channels, so the pan of the
+ * sources is ignored. The chain isn't owned, and 0 switches it off again.
+ * Set it before the sound card starts, this doesn't lock.
+ */
+void AudioMixer::setImpairments(ImpairmentChain *_chain)
+{
+	chain = _chain;
+	if (chain)
+		chain->setSampleRate(rate);
+}
+
+
+/*!
+ * \brief Add \a n samples of \a in to \a left and \a right
+ */
+static void accumulate(const qint16 *in, float *left, float *right, int n, float gl, float gr)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 vl = _mm_set1_ps(gl);
+	const __m128 vr = _mm_set1_ps(gr);
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, x), 16));
+		__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, x), 16));
+		_mm_storeu_ps(left + i,     _mm_add_ps(_mm_loadu_ps(left + i),     _mm_mul_ps(lo, vl)));
+		_mm_storeu_ps(left + i + 4, _mm_add_ps(_mm_loadu_ps(left + i + 4), _mm_mul_ps(hi, vl)));
+		_mm_storeu_ps(right + i,     _mm_add_ps(_mm_loadu_ps(right + i),     _mm_mul_ps(lo, vr)));
+		_mm_storeu_ps(right + i + 4, _mm_add_ps(_mm_loadu_ps(right + i + 4), _mm_mul_ps(hi, vr)));
+	}
+#endif
+	for (; i < n; i++) {
+		left[i] += in[i] * gl;
+		right[i] += in[i] * gr;
+	}
+}
+
+
+/*!
+ * \brief Convert the sums into \a channels of \a type
+ *
+ * The sums are in 16 bit units and get clipped to full scale. For mono
+ * only \a left is used.
+ */
+static void convert(const float *left, const float *right, char *out, int n, int channels, SineSource::SampleType type)
+{
+	// Full scale in the units of the output
+	const float scale = type == SineSource::Int16 ? 1.0f
+		: type == SineSource::Int32 ? 65536.0f : 1.0f / 32768;
+	const float top = 32767 * scale;
+
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128 vs = _mm_set1_ps(scale);
+	const __m128 vmax = _mm_set1_ps(top);
+	const __m128 vmin = _mm_set1_ps(-top);
+	for (; i + 4 <= n; i += 4) {
+		__m128 l = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(left + i), vs), vmin), vmax);
+		__m128 r = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(right + i), vs), vmin), vmax);
+		__m128 a = l, b = l;
+		if (channels == 2) {
+			a = _mm_unpacklo_ps(l, r);
+			b = _mm_unpackhi_ps(l, r);
+		}
+		if (type == SineSource::Float32) {
+			_mm_storeu_ps((float *)out, a);
+			if (channels == 2)
+				_mm_storeu_ps((float *)(out + 16), b);
+		} else if (type == SineSource::Int32) {
+			_mm_storeu_si128((__m128i *)out, _mm_cvtps_epi32(a));
+			if (channels == 2)
+				_mm_storeu_si128((__m128i *)(out + 16), _mm_cvtps_epi32(b));
+		} else {
+			__m128i x = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+			if (channels == 2)
+				_mm_storeu_si128((__m128i *)out, x);
+			else
+				_mm_storel_epi64((__m128i *)out, x);
+		}
+		out += 4 * channels * (type == SineSource::Int16 ? 2 : 4);
+	}
+#endif
+	for (; i < n; i++) {
+		for (int c = 0; c < channels; c++) {
+			float v = qBound(-top, (c ? right[i] : left[i]) * scale, top);
+			switch (type) {
+			case SineSource::Int16: {
+				qint16 x = (qint16)lrintf(v);
+				memcpy(out, &x, 2);
+				out += 2;
+				break; }
+			case SineSource::Int32: {
+				qint32 x = (qint32)lrintf(v);
+				memcpy(out, &x, 4);
+				out += 4;
+				break; }
+			case SineSource::Float32:
+				memcpy(out, &v, 4);
+				out += 4;
+				break;
+			}
+		}
+	}
+}
+
+
+/*!
+ * \brief Returns the mixed samples of all sources
+ *
+ * Sources that are silent only advance their oscillator, they don't get
+ * summed up.
+ *
+ * @param data    destination address
+ * @param maxlen  maximum bytes to copy
+ * @returns       number of bytes copied
+ */
+qint64 AudioMixer::readData(char *data, qint64 maxlen)
+{
+	MYTRACE("AudioMixer::readData(data, %lld)", maxlen);
+
+	int frame = frameBytes();
+	qint64 n = maxlen / frame;
+
+	generation.ref();
+	float left[MIX_BLOCK];
+	float right[MIX_BLOCK];
+	qint16 tone[MIX_BLOCK];
+	for (qint64 done = 0; done < n; ) {
+		int len = (int)qMin(n - done, (qint64)MIX_BLOCK);
+		memset(left, 0, len * sizeof(float));
+		memset(right, 0, len * sizeof(float));
+		for (int i = 0; i < maxSources; i++) {
+			MixerSource *s = sources[i];
+			if (!s)
+				continue;
+			s->update();
+			bool silent = !s->gen->remainingSamples();
+			s->gen->readData((char *)tone, len * 2);
+			if (silent)
+				continue;
+
+			// Equal power panning, mono just uses the level
+			float gl = s->level, gr = 0;
+			if (channels == 2 && !chain) {
+				float a = (s->pan + 1) * (float)M_PI / 4;
+				gl = s->level * cosf(a);
+				gr = s->level * sinf(a);
+			}
+			accumulate(tone, left, right, len, gl, gr);
+		}
+		if (chain) {
+			// Receiver audio is mono, the chain works with 1.0 as full scale
+			for (int i = 0; i < len; i++)
+				left[i] *= 1.0f / 32768;
+			chain->process(left, len);
+			for (int i = 0; i < len; i++)
+				left[i] *= 32768.0f;
+			convert(left, left, data + done * frame, len, channels, type);
+		} else {
+			convert(left, right, data + done * frame, len, channels, type);
+		}
+		done += len;
+	}
+	generation.ref();
+
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+	int size = type == SineSource::Int16 ? 2 : 4;
+	for (char *p = data; p < data + n * frame; p += size)
+		std::reverse(p, p + size);
+#endif
+	memset(data + n * frame, 0, maxlen - n * frame);
+	return maxlen;
+}
+
+
+/*!
+ * \brief Dummy implementation
+ *
+ * This dummy implementation does nothing and is just needed to inherit
+ * successfully from \c QIODevice.
+ */
+qint64 AudioMixer::writeData(const char *data, qint64 len)
+{
+	Q_UNUSED(data);
+	Q_UNUSED(len);
+
+	return 0;
+}
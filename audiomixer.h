@@ -0,0 +1,107 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QIODevice>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+#include "sinesource.h"
+
+
+class ImpairmentChain;
+
+
+/*!
+ * \brief One station in an \ref AudioMixer
+ *
+ * Each source has it's own tone generator, so it can have it's own pitch.
+ * Connect a \ref GenerateMorse to it like to \ref AudioOutput.
+ */
+class MixerSource : public QObject
+{
+	Q_OBJECT
+	friend class AudioMixer;
+public:
+	void setFreq(int freq);
+	void setLevel(float level);
+	void setPan(float pan);
+	void setEnvelope(SineSource::Envelope shape, float riseMs);
+public slots:
+	void playSound(unsigned int ms);
+signals:
+	/*! \brief Emitted by \ref playSound(), so that the output can wake up */
+	void sounding(unsigned int ms);
+
+private:
+	MixerSource(int freq, float level, float pan);
+	void update();
+
+	SineSource *gen;  //!< \brief Tone generator of this source, only used by the mix
+	float level;      //!< \brief Volume, 1.0 is full scale
+	float pan;        //!< \brief -1.0 is left, 0 is center, 1.0 is right
+	QAtomicInt pendingMs;   //!< \brief Tone for the next mix, -1 if none, see \ref playSound()
+	QAtomicInt pendingFreq; //!< \brief Pitch for the next mix, -1 if none
+	QAtomicInt pendingEnv;  //!< \brief Envelope for the next mix, -1 if none, see \ref setEnvelope()
+};
+
+
+/*!
+ * \brief Mixes many \ref MixerSource into one stream of samples
+ *
+ * The sound card pulls from the mixer like from a \ref SineSource. All
+ * sources are summed in one go, so many stations sound at once.
+ *
+ * Sources can be added, changed and removed from any thread while the
+ * sound card is pulling. The mixer doesn't lock: sources sit in a fixed
+ * array of atomic pointers, changes get handed over in atomic ints, and
+ * removing waits only for a running mix to end.
+ */
+class AudioMixer : public QIODevice
+{
+public:
+	AudioMixer(QObject *parent);
+	~AudioMixer();
+	void setFormat(int sampleRate, int chans, SineSource::SampleType sampleType);
+	int frameBytes() const;
+	int sampleRate() const;
+
+	MixerSource *addSource(int freq, float level=1.0, float pan=0.0);
+	void removeSource(MixerSource *source);
+	int remainingMs() const;
+	void setImpairments(ImpairmentChain *chain);
+
+	qint64 readData(char *data, qint64 maxlen);
+	qint64 writeData(const char *data, qint64 len);
+
+	static const int maxSources = 64;
+
+private:
+	int rate;                    //!< \brief Sample rate, see \ref setFormat()
+	int channels;                //!< \brief 1 or 2, see \ref setFormat()
+	SineSource::SampleType type; //!< \brief Format of the samples, see \ref setFormat()
+
+	QAtomicPointer<MixerSource> sources[maxSources]; //!< \brief Empty slots are 0
+	QAtomicInt generation;       //!< \brief Odd while \ref readData() mixes
+	ImpairmentChain *chain;      //!< \brief Optional, see \ref setImpairments()
+};
+
+
+#endif
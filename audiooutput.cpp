@@ -7,7 +7,8 @@
  *
  * @section DESCRIPTION
  *
- * Simple sine audio generator.
+ * Plays the sines of \ref AudioMixer on the sound card, or into
+ * another \ref AudioSink.
  *
  * @section LICENSE
  *
@@ -28,220 +29,191 @@
 #include <QIODevice>
 #include <QTimer>
 
-#include <math.h>
 #include "audiooutput.h"
+#include "audiomixer.h"
 
-#ifndef M_PI
 /*!
- * \brief Representation of pi
- */
-#define M_PI 3.14159265358979323846
-#endif
-
-/*!
- * \brief Sample rate of sound card
- *
- * In Hertz.
- */
-#define SAMPLE_RATE 44100
-
-/*!
- * \brief Buffer size for \ref AudioOutput
+ * \brief Size of the sound card buffer for \ref DeviceSink
  *
- * In Bytes.
+ * In milliseconds. Whatever sits in this buffer is played before a new
+ * tone, so this is the latency between keying and hearing.
  */
-#define BUFFER_SIZE 8196
+#define BUFFER_MS 8
 
 
 /*!
- * \brief Sine wave generator source for \ref AudioOutput
+ * \brief Time after the end of a tone until \ref AudioOutput goes idle
+ *
+ * In milliseconds. Must be more than \ref BUFFER_MS so that the tail of
+ * the tone has left the sound card. It also keeps the device running
+ * between elements of the same word.
  */
-class SineSource : public QIODevice
-{
-public:
-	SineSource(int freq, QObject *parent);
-	~SineSource();
-	void setFreq(int freq);
-	void setDuration(int ms);
-
-	qint64 readData(char *data, qint64 maxlen);
-	qint64 writeData(const char *data, qint64 len);
-
-private:
-	int freq;
-	int *buffer;  //!< \brief Sine wave buffer
-	int *sendpos; //!< \brief Current pos into the circular \ref buffer
-	int *end;     //!< \brief Last position in \ref buffer, for faster comparison
-	int samples;  //!< \brief Samples to play for desired sound duration
-};
+#define IDLE_MS 250
 
 
 /*!
- * \brief Sine wave generator source for \ref AudioOutput
+ * \brief Sink for the sound card
  *
- * @param freq    desired frequency of sine wave
- * @param parent  parent QObject, if any
+ * The sound card runs in pull mode: it reads directly from the source
+ * whenever it needs samples, into it's own buffer. So there's no copy in
+ * between and no timer that would add latency.
  *
- * This class is taylored to be used with \ref AudioOutput, but basically
- * it's usage pattern looks like this:
- *
- * \code
- *   gen = new SineSource(800, this);
- *   gen->setDuration(ms);
- *   while (1) {
- *        int l = gen->read(buffer, audioOutput->periodSize());
- *        if (!l) break;
- *        	output->write(buffer, l)
- *   }
- * \endcode
+ * @param parent  QObject parent, if any
  */
-SineSource::SineSource(int freq, QObject *parent)
-	: QIODevice(parent)
-	, buffer(0)
+DeviceSink::DeviceSink(QObject *parent)
+	: AudioSink(parent)
+	, audioOutput(0)
 {
-	setFreq(freq);
-	open(QIODevice::ReadOnly);
 }
 
 
-/*!
- * \brief Class destructor
- *
- * Simply get's rid of \ref buffer.
- */
-SineSource::~SineSource()
+DeviceSink::~DeviceSink()
 {
-	delete[] buffer;
+	stop();
 }
 
 
 /*!
- * \brief Change generated frequency
- *
- * Calling this method creates a new \ref buffer with 3 full waves of the
- * desired frequency. After this, you can call \ref setDuration() and than
- * consume the bytes using \ref readData().
+ * \brief Negotiate the format with the default sound card
  *
- * @param frequency desiged frequency in Hz. Should be below 10000 Hertz.
+ * If it doesn't take what's asked for, the nearest format that
+ * \ref SineSource can make is used, e.g. 48 kHz float stereo.
  */
-void SineSource::setFreq(int frequency)
+bool DeviceSink::negotiate(int &_rate, int &chans, SineSource::SampleType &sampleType)
 {
-	MYTRACE("SineSource::setFreq(%d)", frequency);
-
-	if (buffer)
-		delete[] buffer;
-	freq = frequency;
+	QAudioFormat settings;
+	settings.setFrequency(_rate);
+	settings.setChannels(chans);
+	settings.setSampleSize(sampleType == SineSource::Int16 ? 16 : 32);
+	settings.setCodec("audio/pcm");
+	settings.setByteOrder(QAudioFormat::LittleEndian);
+	settings.setSampleType(sampleType == SineSource::Float32 ? QAudioFormat::Float : QAudioFormat::SignedInt);
 
-	const int upper_freq = 10000;
-	const int full_waves = 3;
+	QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
+	if (!info.isFormatSupported(settings))
+		settings = info.nearestFormat(settings);
 
-	// Arbitrary upper frequency
-	if (freq > upper_freq)
-		freq = upper_freq;
+	// Let the generator produce whatever the sound card wants natively
+	if (settings.sampleType() == QAudioFormat::Float && settings.sampleSize() == 32)
+		sampleType = SineSource::Float32;
+	else if (settings.sampleType() == QAudioFormat::SignedInt && settings.sampleSize() == 32)
+		sampleType = SineSource::Int32;
+	else if (settings.sampleType() == QAudioFormat::SignedInt && settings.sampleSize() == 16)
+		sampleType = SineSource::Int16;
+	else {
+		qWarning("Audio format with %d bit samples of type %d not supported",
+			settings.sampleSize(), settings.sampleType());
+		return false;
+	}
+	if (settings.channels() < 1 || settings.channels() > 2) {
+		qWarning("Audio format with %d channels not supported", settings.channels());
+		return false;
+	}
+	if (settings.byteOrder() != QAudioFormat::LittleEndian) {
+		qWarning("Big endian audio format not supported");
+		return false;
+	}
+	MYVERBOSE("audio format %d Hz, %d channels, %d bit", settings.frequency(),
+		settings.channels(), settings.sampleSize());
+	_rate = settings.frequency();
+	chans = settings.channels();
+	return AudioSink::negotiate(_rate, chans, sampleType);
+}
 
-	// We create a buffer with some full waves of freq,
-	// therefore we need room for this many samples:
-	int buflen = SAMPLE_RATE * full_waves / freq;
 
-	MYVERBOSE("buf needs to hold %d samples", buflen);
+bool DeviceSink::start(QIODevice *_source)
+{
+	MYTRACE("DeviceSink::start");
 
-	buffer = new int[buflen];
+	QAudioFormat settings;
+	settings.setFrequency(rate);
+	settings.setChannels(channels);
+	settings.setSampleSize(type == SineSource::Int16 ? 16 : 32);
+	settings.setCodec("audio/pcm");
+	settings.setByteOrder(QAudioFormat::LittleEndian);
+	settings.setSampleType(type == SineSource::Float32 ? QAudioFormat::Float : QAudioFormat::SignedInt);
 
-	// Now fill this buffer with the sine wave
-	int *t = buffer;
-	for (int i = 0; i < buflen; i++) {
-		int value = 32767.0 * sin(M_PI * 2 * i * freq / SAMPLE_RATE);
-		MYVERBOSE("%4d: %6d, pos %d", i, value, t - buffer);
-		*t++ = value;
+	// A second start() replaces the device, two would pull from the source
+	if (audioOutput) {
+		audioOutput->stop();
+		delete audioOutput;
 	}
 
-	sendpos = buffer;
-	end = buffer + buflen;
-	samples = 0;
+	source = _source;
+	suspended = false;
+	audioOutput = new QAudioOutput(settings, this);
+	audioOutput->setBufferSize(rate * frameBytes() * BUFFER_MS / 1000);
+	audioOutput->start(source);
+	return audioOutput->error() == QAudio::NoError;
 }
 
 
-/*!
- * \brief Generate sine for \c ms milliseconds
- *
- * This calculates how many \ref samples from \ref buffer are needed for the
- * specified sound duration duration. Later, \ref readData() won't return
- * more than this number of samples.
- *
- * @param ms   sound duration in milliseconds
- */
-void SineSource::setDuration(int ms)
+void DeviceSink::suspend()
 {
-	samples = (SAMPLE_RATE * ms) / 1000;
-	samples &= 0x7ffffffe;
-	sendpos = buffer;
+	suspended = true;
+	if (audioOutput)
+		audioOutput->suspend();
 }
 
 
 /*!
- * \brief Returns entries from \ref buffer
+ * \brief Continue after \ref suspend()
  *
- * Is is a on overwritten method from \c QIODevice which will return the
- * samples of a sine-wave.
- *
- * You need to call \ref setDuration() first
- *
- * @param data    destination address
- * @param maxlen  maximum bytes to copy
- * @returns       number of bytes copied
+ * The device still holds at most \ref BUFFER_MS of silence, so the tone
+ * starts after that. Resuming makes it pull right away, which pre-rolls
+ * the start of the tone into it's buffer.
  */
-qint64 SineSource::readData(char *data, qint64 maxlen)
+void DeviceSink::resume()
 {
-	MYTRACE("SineSource::readData(data, %lld, samples %d)", maxlen, samples);
-
-	quint64 len = maxlen;
-
-	char *t = data;
-	while (len) {
-		// As long as we should provide samples, do this:
-		if (samples) {
-			int value = *sendpos++;
-			//TODO: this is the place where we could modify the
-			//value, e.g. to ramp it up or down, or to attenuate it
-			if (sendpos == end)
-				sendpos = buffer;
-			*t++ = value        & 0xff;
-			*t++ = (value >> 8) & 0xff;
-			samples--;
-		} else {
-			// But afterwards, return zero
-			*t++ = 0;
-			*t++ = 0;
-		}
-		len -= 2;
-	}
-	return maxlen;
+	suspended = false;
+	if (audioOutput)
+		audioOutput->resume();
+}
+
+
+void DeviceSink::stop()
+{
+	if (audioOutput)
+		audioOutput->stop();
+	source = 0;
 }
 
 
 /*!
- * \brief Dummy implementation
- *
- * This dummy implementation does nothing and is just needed to inherit
- * successfully from \c QIODevice.
+ * \brief Returns the number of frames the sound card has played
  */
-qint64 SineSource::writeData(const char *data, qint64 len)
+qint64 DeviceSink::frames() const
 {
-	Q_UNUSED(data);
-	Q_UNUSED(len);
-
-	return 0;
+	if (!audioOutput)
+		return 0;
+	return audioOutput->processedUSecs() * rate / 1000000;
 }
 
 
 
-
 /*!
  * \brief Audio generator for morse code
  *
  * This class generates sound for some milliseconds.
  *
+ * The sound is made by an \ref AudioMixer and goes into an
+ * \ref AudioSink, by default the sound card. Which sink doesn't matter
+ * for the sound generation, so e.g. a \ref NullSink can be used on a
+ * machine without a sound card.
+ *
+ * The format is negotiated: if the sink doesn't take 44.1 kHz 16 bit
+ * mono, \ref AudioMixer produces the nearest format it supports, e.g.
+ * 48 kHz float stereo.
+ *
+ * \ref playSound() plays on a default 800 Hz source. More stations, each
+ * with their own pitch, level and pan, can be added with \ref addSource().
+ *
+ * When nothing is keyed, the sink gets suspended: no samples are made
+ * and nothing wakes the process up until the next \ref playSound().
+ *
  * @param parent  QObject parent, if any
+ * @param _sink   where the sound goes, this object takes ownership.
+ *                Without one, a \ref DeviceSink is used.
  *
  * Usage:
  * \code
@@ -251,95 +223,130 @@ qint64 SineSource::writeData(const char *data, qint64 len)
  *   morse->play();
  * \endcode
  */
-AudioOutput::AudioOutput(QObject *parent)
+AudioOutput::AudioOutput(QObject *parent, AudioSink *_sink)
 	: QObject(parent)
-	, audioOutput(0)
+	, sink(0)
+	, idleTimer(0)
 {
-	buffer = new char[BUFFER_SIZE];
+	mixer = new AudioMixer(this);
+	source = addSource(800);
+
+	if (!_sink)
+		_sink = new DeviceSink(this);
+	else
+		_sink->setParent(this);
+
+	int rate = SAMPLE_RATE;
+	int channels = 1;
+	SineSource::SampleType type = SineSource::Int16;
+	if (!_sink->negotiate(rate, channels, type))
+		return;
+	mixer->setFormat(rate, channels, type);
+	if (!_sink->start(mixer))
+		return;
+	sink = _sink;
 
-	QAudioFormat settings;
-	settings.setFrequency(SAMPLE_RATE);
-	settings.setChannels(1);
-	settings.setSampleSize(16);
-	settings.setCodec("audio/pcm");
-	settings.setByteOrder(QAudioFormat::LittleEndian);
-	settings.setSampleType(QAudioFormat::SignedInt);
+	idleTimer = new QTimer(this);
+	idleTimer->setSingleShot(true);
+	connect(idleTimer, SIGNAL(timeout()), SLOT(suspendIfIdle()));
+	idleTimer->start(IDLE_MS);
+}
 
-	QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
-	if (!info.isFormatSupported(settings)) {
-		qWarning("Default audio format not supported, sound may be distorted");
-		settings = info.nearestFormat(settings);
-	}
 
-	if (settings.sampleSize() != 16) {
-		qWarning("Audio doesn't support 16 bit samples");
-		return;
-	}
+/*!
+ * \brief Class destructor
+ */
+AudioOutput::~AudioOutput()
+{
+	MYTRACE("AudioOutput::~AudioOutput");
 
-	gen = new SineSource(800, this);
+	if (sink)
+		sink->stop();
+}
 
-	audioOutput = new QAudioOutput(settings, this);
 
-	output = audioOutput->start();
-	timer = new QTimer(this);
-	connect(timer, SIGNAL(timeout()), SLOT(writeMore()));
-	timer->setSingleShot(true);
+/*!
+ * \brief Change how tones rise and fall, see \ref SineSource::setEnvelope()
+ */
+void AudioOutput::setEnvelope(SineSource::Envelope shape, float riseMs)
+{
+	source->setEnvelope(shape, riseMs);
 }
 
 
 /*!
- * \brief Class destructor
+ * \brief Add another station to the sound
  *
- * Destroy's \ref buffer.
+ * Connect a \ref GenerateMorse to the returned source just like to
+ * \ref playSound(). The parameters are those of
+ * \ref AudioMixer::addSource().
+ *
+ * @returns  the source, or 0 if the mixer is full
  */
-AudioOutput::~AudioOutput()
+MixerSource *AudioOutput::addSource(int freq, float level, float pan)
 {
-	MYTRACE("AudioOutput::~AudioOutput");
+	MixerSource *s = mixer->addSource(freq, level, pan);
+	if (s)
+		connect(s, SIGNAL(sounding(unsigned int)), SLOT(wake(unsigned int)));
+	return s;
+}
 
-	delete[] buffer;
+
+/*!
+ * \brief Remove a station that was added by \ref addSource()
+ */
+void AudioOutput::removeSource(MixerSource *s)
+{
+	mixer->removeSource(s);
 }
 
 
 /*!
- * \brief Send more data from \ref SineSource to \c QAudioOutput
+ * \brief Start sound generation
  *
- * This is an interal signal, called via \ref timer. This timer
- * is called periodically as long as more data should be played.
+ * @param ms  Desired sound duration in milliseconds.
  */
-void AudioOutput::writeMore()
+void AudioOutput::playSound(unsigned int ms)
 {
-	MYTRACE("AudioOutput::writeMore");
+	MYTRACE("AudioOutput::playSound(%d)", ms);
 
-	if (!audioOutput)
-		return;
+	source->playSound(ms);
+}
 
-	if (audioOutput->state() == QAudio::StoppedState)
+
+/*!
+ * \brief Make sure the sound card plays a tone of \a ms milliseconds
+ *
+ * Called whenever any source starts a tone.
+ */
+void AudioOutput::wake(unsigned int ms)
+{
+	if (!sink)
 		return;
 
-	// If we would write this into a file, we could convert it to a WAV
-	// file with this command:
-	//       sox -r 44100 -e signed -b 16 -c 1 a.raw a.wav
-	int chunks = audioOutput->bytesFree() / audioOutput->periodSize();
-	while (chunks) {
-		int l = gen->read(buffer, audioOutput->periodSize());
-		if (l > 0)
-			output->write(buffer, l);
-		chunks--;
+	if (sink->isSuspended()) {
+		MYVERBOSE("resume audio");
+		sink->resume();
 	}
-	timer->start(30);
+	idleTimer->start(ms + IDLE_MS);
 }
 
 
 /*!
- * \brief Start sound generation
+ * \brief Suspend the sound card if there's nothing to play
  *
- * @param ms  Desired sound duration in milliseconds.
+ * Called once by \ref idleTimer after the last tone, not periodically.
  */
-void AudioOutput::playSound(unsigned int ms)
+void AudioOutput::suspendIfIdle()
 {
-	MYTRACE("AudioOutput::playSound(%d)", ms);
+	MYTRACE("AudioOutput::suspendIfIdle");
 
-	gen->setDuration(ms);
-	audioOutput->resume();
-	writeMore();
+	int ms = mixer->remainingMs();
+	if (ms) {
+		// Some tone is still running, look again when it's over
+		idleTimer->start(ms + IDLE_MS);
+		return;
+	}
+	MYVERBOSE("suspend audio");
+	sink->suspend();
 }
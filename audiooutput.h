@@ -21,35 +21,61 @@
 
 #include <QObject>
 
+#include "sinesource.h"
+#include "audiosink.h"
+
 
-class QIODevice;
 class QAudioOutput;
 class QTimer;
-class SineSource;
+class AudioMixer;
+class MixerSource;
+
+
+/*!
+ * \brief Sink that plays on the sound card, using the Qt Multimedia framework
+ */
+class DeviceSink : public AudioSink
+{
+	Q_OBJECT
+public:
+	DeviceSink(QObject *parent=0);
+	~DeviceSink();
+	bool negotiate(int &rate, int &chans, SineSource::SampleType &sampleType);
+	bool start(QIODevice *source);
+	void suspend();
+	void resume();
+	void stop();
+	qint64 frames() const;
+private:
+	QAudioOutput *audioOutput; //!< \brief Sound output device from Qt's multimedia
+};
 
 
 /*!
- * \brief Sound generator for short beeps using the Qt Multimedia framework
+ * \brief Sound generator for short beeps
  */
 class AudioOutput : public QObject
 {
 	Q_OBJECT
 public:
-	AudioOutput(QObject *parent);
+	AudioOutput(QObject *parent, AudioSink *sink=0);
 	~AudioOutput();
+	void setEnvelope(SineSource::Envelope shape, float riseMs);
+	MixerSource *addSource(int freq, float level=1.0, float pan=0.0);
+	void removeSource(MixerSource *s);
 public slots:
 	void playSound(unsigned int ms);
 
 private:
-	SineSource *gen; //!< \brief QIODevice which generates sound
-	char *buffer;    //!< \brief Buffer that holds sound samples
+	AudioMixer *mixer;   //!< \brief QIODevice which generates sound, read by \ref sink
+	MixerSource *source; //!< \brief Source for \ref playSound()
 
-	QAudioOutput *audioOutput; //!< \brief Sound output device from Qt's multimedia
-	QIODevice *output;         //!< \brief QIODevice associated to \ref audioOutput
-	QTimer *timer;             //!< \brief Timer to call \ref writeMore()
+	AudioSink *sink;     //!< \brief Where the sound goes, 0 if it couldn't start
+	QTimer *idleTimer;   //!< \brief Fires once after the last tone, see \ref suspendIfIdle()
 
 private slots:
-	void writeMore();
+	void wake(unsigned int ms);
+	void suspendIfIdle();
 };
 
 
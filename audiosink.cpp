@@ -0,0 +1,373 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Destinations for audio samples that don't need a sound card.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QTimer>
+
+#include "audiosink.h"
+#include "render_morse.h"
+
+
+/*!
+ * \brief Frames per read from the source in \ref AudioSink::pump()
+ */
+#define PUMP_FRAMES 4096
+
+
+/*!
+ * \brief Interval of the timer in realtime mode
+ *
+ * In milliseconds. A tone starts at most this late.
+ */
+#define TICK_MS 10
+
+
+/*!
+ * \brief Base class of the sinks
+ *
+ * Starts in realtime mode.
+ */
+AudioSink::AudioSink(QObject *parent)
+	: QObject(parent)
+	, source(0)
+	, rate(SAMPLE_RATE)
+	, channels(1)
+	, type(SineSource::Int16)
+	, frameCount(0)
+	, suspended(false)
+	, realtime(true)
+	, clockFrames(0)
+{
+	timer = new QTimer(this);
+	connect(timer, SIGNAL(timeout()), SLOT(tick()));
+	buffer = new char[PUMP_FRAMES * 8];
+}
+
+
+/*!
+ * \brief Class destructor
+ */
+AudioSink::~AudioSink()
+{
+	delete[] buffer;
+}
+
+
+/*!
+ * \brief Agree on a sample format
+ *
+ * The caller passes in what it would like. The sink changes that into
+ * what it can take, and returns false if it can't play at all. This
+ * default takes everything that \ref SineSource can make.
+ */
+bool AudioSink::negotiate(int &_rate, int &chans, SineSource::SampleType &sampleType)
+{
+	rate = _rate;
+	channels = chans;
+	type = sampleType;
+	return true;
+}
+
+
+/*!
+ * \brief Start pulling from \a _source
+ *
+ * In realtime mode a timer pulls as many samples as have been played
+ * since the start. Otherwise call \ref pump().
+ *
+ * @returns false if the sink couldn't be opened
+ */
+bool AudioSink::start(QIODevice *_source)
+{
+	MYTRACE("AudioSink::start");
+
+	source = _source;
+	frameCount = 0;
+	suspended = false;
+	if (realtime) {
+		clock.start();
+		clockFrames = 0;
+		timer->start(TICK_MS);
+	}
+	return true;
+}
+
+
+/*!
+ * \brief Stop pulling until \ref resume()
+ */
+void AudioSink::suspend()
+{
+	suspended = true;
+	timer->stop();
+}
+
+
+/*!
+ * \brief Continue after \ref suspend()
+ *
+ * The time while suspended doesn't count, the pulling starts fresh.
+ */
+void AudioSink::resume()
+{
+	if (!suspended)
+		return;
+	suspended = false;
+	if (realtime && source) {
+		clock.start();
+		clockFrames = 0;
+		// Pre-roll one tick, so the tone starts right away
+		pump((qint64)rate * TICK_MS / 1000);
+		timer->start(TICK_MS);
+	}
+}
+
+
+/*!
+ * \brief Stop pulling for good
+ */
+void AudioSink::stop()
+{
+	timer->stop();
+	source = 0;
+}
+
+
+/*!
+ * \brief Returns the number of frames written
+ */
+qint64 AudioSink::frames() const
+{
+	return frameCount;
+}
+
+
+/*!
+ * \brief Returns true between \ref suspend() and \ref resume()
+ */
+bool AudioSink::isSuspended() const
+{
+	return suspended;
+}
+
+
+/*!
+ * \brief Switch between timer driven and \ref pump() driven pulling
+ *
+ * Call this before \ref start().
+ */
+void AudioSink::setRealtime(bool on)
+{
+	realtime = on;
+}
+
+
+/*!
+ * \brief Returns the size of one frame in bytes
+ */
+int AudioSink::frameBytes() const
+{
+	return channels * (type == SineSource::Int16 ? 2 : 4);
+}
+
+
+/*!
+ * \brief Pull \a n frames from the source and write them
+ *
+ * @returns number of frames written, or -1 on a write error
+ */
+qint64 AudioSink::pump(qint64 n)
+{
+	if (!source)
+		return 0;
+
+	int frame = frameBytes();
+	qint64 done = 0;
+	while (done < n) {
+		int len = (int)qMin(n - done, (qint64)PUMP_FRAMES);
+		// Sources are unbuffered, so this goes straight to readData()
+		source->read(buffer, len * frame);
+		if (!write(buffer, len * frame))
+			return -1;
+		done += len;
+	}
+	frameCount += done;
+	return done;
+}
+
+
+/*!
+ * \brief Write \a len bytes of samples
+ *
+ * The default implementation throws them away.
+ */
+bool AudioSink::write(const char *data, qint64 len)
+{
+	Q_UNUSED(data);
+	Q_UNUSED(len);
+
+	return true;
+}
+
+
+/*!
+ * \brief Pull the frames that have been due since the last tick
+ */
+void AudioSink::tick()
+{
+	qint64 due = clock.nsecsElapsed() * rate / 1000000000;
+	if (pump(due - clockFrames) < 0) {
+		qWarning("AudioSink: write error, stopping");
+		stop();
+		return;
+	}
+	clockFrames = due;
+}
+
+
+
+/*!
+ * \brief Sink that only counts samples
+ *
+ * Use it on machines without a sound card, and to measure how fast the
+ * samples can be made.
+ */
+NullSink::NullSink(QObject *parent)
+	: AudioSink(parent)
+{
+}
+
+
+
+/*!
+ * \brief Sink into a file
+ *
+ * @param fname   file name, with ".wav" it get's a WAV header
+ * @param parent  QObject parent, if any
+ */
+FileSink::FileSink(const QString &fname, QObject *parent)
+	: AudioSink(parent)
+	, file(fname)
+{
+	wav = fname.endsWith(".wav", Qt::CaseInsensitive);
+}
+
+
+/*!
+ * \brief Class destructor
+ *
+ * Finishes the file, if \ref stop() hasn't been called.
+ */
+FileSink::~FileSink()
+{
+	stop();
+}
+
+
+bool FileSink::start(QIODevice *_source)
+{
+	MYTRACE("FileSink::start(%s)", qPrintable(file.fileName()));
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qWarning("Can't write to %s", qPrintable(file.fileName()));
+		return false;
+	}
+	if (wav)
+		RenderMorse::writeWavHeader(&file, -1, rate, channels, type);
+	return AudioSink::start(_source);
+}
+
+
+/*!
+ * \brief Stop and close the file
+ *
+ * Only now the WAV header get's the right size.
+ */
+void FileSink::stop()
+{
+	AudioSink::stop();
+	if (!file.isOpen())
+		return;
+	if (wav) {
+		file.seek(0);
+		RenderMorse::writeWavHeader(&file, frameCount, rate, channels, type);
+	}
+	file.close();
+}
+
+
+bool FileSink::write(const char *data, qint64 len)
+{
+	return file.write(data, len) == len;
+}
+
+
+
+/*!
+ * \brief Sink into a pipe
+ *
+ * @param _fd     file descriptor, 1 is stdout
+ * @param _wav    start with a WAV header. The size in it is unknown, but
+ *                most programs don't care when they read from a pipe.
+ * @param parent  QObject parent, if any
+ */
+PipeSink::PipeSink(int _fd, bool _wav, QObject *parent)
+	: AudioSink(parent)
+	, fd(_fd)
+	, wav(_wav)
+{
+}
+
+
+PipeSink::~PipeSink()
+{
+	stop();
+}
+
+
+bool PipeSink::start(QIODevice *_source)
+{
+	MYTRACE("PipeSink::start(%d)", fd);
+
+	if (!file.open(fd, QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+		qWarning("Can't write to file descriptor %d", fd);
+		return false;
+	}
+	if (wav)
+		RenderMorse::writeWavHeader(&file, -1, rate, channels, type);
+	return AudioSink::start(_source);
+}
+
+
+void PipeSink::stop()
+{
+	AudioSink::stop();
+	file.close();
+}
+
+
+bool PipeSink::write(const char *data, qint64 len)
+{
+	return file.write(data, len) == len;
+}
@@ -0,0 +1,136 @@
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include "sinesource.h"
+
+
+class QTimer;
+
+
+/*!
+ * \brief Where the samples of \ref AudioOutput go
+ *
+ * A sink pulls samples from a source device, e.g. \ref AudioMixer. The
+ * source doesn't know what kind of sink it is.
+ *
+ * Sinks without a clock of their own (\ref NullSink, \ref FileSink and
+ * \ref PipeSink) can either pull in realtime, driven by a timer, or as
+ * fast as possible with \ref pump(). The latter is what benchmarks and
+ * offline rendering want.
+ */
+class AudioSink : public QObject
+{
+	Q_OBJECT
+public:
+	virtual ~AudioSink();
+	virtual bool negotiate(int &rate, int &chans, SineSource::SampleType &sampleType);
+	virtual bool start(QIODevice *source);
+	virtual void suspend();
+	virtual void resume();
+	virtual void stop();
+	virtual qint64 frames() const;
+	bool isSuspended() const;
+	void setRealtime(bool on);
+	qint64 pump(qint64 n);
+
+protected:
+	AudioSink(QObject *parent);
+	int frameBytes() const;
+	virtual bool write(const char *data, qint64 len);
+
+	QIODevice *source;           //!< \brief Where the samples come from
+	int rate;                    //!< \brief Sample rate, see \ref negotiate()
+	int channels;                //!< \brief Channels, see \ref negotiate()
+	SineSource::SampleType type; //!< \brief Sample format, see \ref negotiate()
+	qint64 frameCount;           //!< \brief Frames written so far
+	bool suspended;              //!< \brief See \ref suspend()
+
+private slots:
+	void tick();
+
+private:
+	bool realtime;        //!< \brief Pull driven by \ref timer, see \ref setRealtime()
+	QTimer *timer;        //!< \brief Calls \ref tick() in realtime mode
+	QElapsedTimer clock;  //!< \brief Time since start or resume
+	qint64 clockFrames;   //!< \brief Frames pulled since \ref clock started
+	char *buffer;         //!< \brief Samples on their way from source to sink
+};
+
+
+/*!
+ * \brief Sink that throws the samples away and only counts them
+ */
+class NullSink : public AudioSink
+{
+	Q_OBJECT
+public:
+	NullSink(QObject *parent=0);
+};
+
+
+/*!
+ * \brief Sink that writes into a raw or WAV file
+ *
+ * If the file name ends with ".wav", it get's a WAV header.
+ */
+class FileSink : public AudioSink
+{
+	Q_OBJECT
+public:
+	FileSink(const QString &fname, QObject *parent=0);
+	~FileSink();
+	bool start(QIODevice *source);
+	void stop();
+protected:
+	bool write(const char *data, qint64 len);
+private:
+	QFile file; //!< \brief The file
+	bool wav;   //!< \brief Write a WAV header
+};
+
+
+/*!
+ * \brief Sink that writes into a pipe, by default stdout
+ *
+ * E.g. into "aplay -t raw -f S16_LE -r 44100" or into sox.
+ */
+class PipeSink : public AudioSink
+{
+	Q_OBJECT
+public:
+	PipeSink(int fd=1, bool wav=false, QObject *parent=0);
+	~PipeSink();
+	bool start(QIODevice *source);
+	void stop();
+protected:
+	bool write(const char *data, qint64 len);
+private:
+	QFile file; //!< \brief Wraps \ref fd
+	int fd;     //!< \brief File descriptor to write to
+	bool wav;   //!< \brief Start with a WAV header without size
+};
+
+
+#endif
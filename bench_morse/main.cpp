@@ -0,0 +1,640 @@
+/*
+ * Micro benchmarks for the morse classes. Run it from inside the
+ * bench_morse directory, it loads ../characters.csv.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QtAlgorithms>
+#include <QFile>
+#include <QBuffer>
+#include <QVector>
+
+#include "morse.h"
+#include "decode_morse.h"
+#include "decode_audio.h"
+#include "decode_keying.h"
+#include "decode_viterbi.h"
+#include "render_morse.h"
+#include "impairment.h"
+#include "audiomixer.h"
+#include "audiosink.h"
+#include "skimmer.h"
+#include "sinesource.h"
+#include "characters.h"
+
+#include <stdio.h>
+#include <math.h>
+
+
+#ifdef __GLIBC__
+/*
+ * Count what get's allocated. Qt allocates through malloc(), so we simply
+ * put our own malloc() in front of the one from glibc.
+ */
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static quint64 allocBytes = 0;
+static quint64 allocCount = 0;
+
+extern "C" void *malloc(size_t size)
+{
+	allocBytes += size;
+	allocCount++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+	allocBytes += n * size;
+	allocCount++;
+	return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	allocBytes += size;
+	allocCount++;
+	return __libc_realloc(ptr, size);
+}
+#else
+static quint64 allocBytes = 0;
+static quint64 allocCount = 0;
+#endif
+
+
+/*!
+ * \brief Repeat the lookup of all known signs this many times
+ */
+const int rounds = 20000;
+
+
+/*!
+ * \brief Look up every sign from \c chars via Morse::contains() and
+ * Morse::operator[], just like GenerateMorse::append() does.
+ *
+ * @returns nanoseconds per lookup
+ */
+static double benchLookup(const QStringList &signs)
+{
+	Morse codes;
+	int found = 0;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int r = 0; r < rounds; r++) {
+		foreach(const QString &s, signs) {
+			if (codes.contains(s))
+				found += codes[s].size();
+		}
+	}
+	qint64 ns = timer.nsecsElapsed();
+
+	if (!found)
+		qWarning("nothing found");
+	return (double)ns / rounds / signs.count();
+}
+
+
+/*!
+ * \brief Same as benchLookup(), but uses the allocation-free Morse::lookup()
+ */
+static double benchStatic(const QStringList &signs)
+{
+	Morse codes;
+	int found = 0;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int r = 0; r < rounds; r++) {
+		foreach(const QString &s, signs) {
+			const MorseTableEntry *e = codes.lookup(s.constData(), s.size());
+			if (e)
+				found += e->len;
+		}
+	}
+	qint64 ns = timer.nsecsElapsed();
+
+	if (!found)
+		qWarning("nothing found");
+	return (double)ns / rounds / signs.count();
+}
+
+
+/*!
+ * \brief Encode some text with GenerateMorse::append()
+ *
+ * @param compact  use GenerateMorse::setCompact()
+ * @returns nanoseconds per encoded character
+ */
+static double benchEncode(bool compact)
+{
+	QString text;
+	for (int i = 0; i < 2000; i++)
+		text.append("cq cq de dh3hs pse k ");
+
+	GenerateMorse gen;
+	gen.setCompact(compact);
+	QElapsedTimer timer;
+	timer.start();
+	for (int r = 0; r < 10; r++) {
+		gen.clear();
+		gen.append(text);
+	}
+	qint64 ns = timer.nsecsElapsed();
+
+	return (double)ns / 10 / text.size();
+}
+
+
+/*!
+ * \brief Encode a big text in one go with GenerateMorse::appendText()
+ *
+ * Prints characters per second and how much got allocated.
+ *
+ * @param text     Latin-1 text
+ * @param compact  use GenerateMorse::setCompact()
+ */
+static void benchBulk(const QByteArray &text, bool compact)
+{
+	GenerateMorse gen;
+	gen.setCompact(compact);
+
+	quint64 bytes = allocBytes;
+	quint64 count = allocCount;
+	QElapsedTimer timer;
+	timer.start();
+	gen.appendText(text, GenerateMorse::SubstituteUnknown);
+	qint64 ns = timer.nsecsElapsed();
+	bytes = allocBytes - bytes;
+	count = allocCount - count;
+
+	printf("appendText(), %s: %6.1f MB in %7.2f ms, %6.1f M chars/s, "
+	       "%llu allocations, %.2f bytes/char\n",
+	       compact ? "compact" : "normal ",
+	       text.size() / 1e6, ns / 1e6,
+	       text.size() * 1e3 / ns,
+	       count, (double)bytes / text.size());
+}
+
+
+/*!
+ * \brief Encode a file with GenerateMorse::appendFile()
+ */
+static void benchFile(const QString &fname)
+{
+	GenerateMorse gen;
+	gen.setCompact(true);
+
+	quint64 bytes = allocBytes;
+	QElapsedTimer timer;
+	timer.start();
+	if (!gen.appendFile(fname, GenerateMorse::SubstituteUnknown)) {
+		printf("can't read %s\n", qPrintable(fname));
+		return;
+	}
+	qint64 ns = timer.nsecsElapsed();
+	bytes = allocBytes - bytes;
+
+	printf("appendFile(%s): %.2f ms, %llu bytes allocated\n",
+	       qPrintable(fname), ns / 1e6, bytes);
+}
+
+
+/*!
+ * \brief Decode the morse of \a text with DecodeMorse::decode()
+ *
+ * Decodes both as dit/dah text and as elements, and prints the decoded
+ * characters per second.
+ */
+static void benchDecode(const QByteArray &text)
+{
+	GenerateMorse gen;
+	gen.appendText(text, GenerateMorse::SubstituteUnknown);
+	QList<int> elements = gen.elements();
+
+	QByteArray code;
+	code.reserve(text.size() * 5);
+	foreach(int e, elements) {
+		if (e == 1)
+			code.append('.');
+		else if (e == 3)
+			code.append('-');
+		else if (e == -3)
+			code.append(' ');
+		else if (e == -7)
+			code.append(" / ");
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	QString s1 = DecodeMorse::decode(code);
+	qint64 ns1 = timer.nsecsElapsed();
+	timer.start();
+	QString s2 = DecodeMorse::decode(elements);
+	qint64 ns2 = timer.nsecsElapsed();
+
+	if (s1 != s2)
+		printf("decoded text and elements differ\n");
+	printf("decoded: %s...\n", qPrintable(s1.left(60)));
+	printf("decode(), text:     %6.1f M chars/s\n", s1.size() * 1e3 / ns1);
+	printf("decode(), elements: %6.1f M chars/s\n", s2.size() * 1e3 / ns2);
+}
+
+
+/*!
+ * \brief Render \a text with RenderMorse into /dev/null
+ *
+ * Prints how much faster than realtime this is. With \a impaired, the
+ * samples go through a full \ref ImpairmentChain. Without \a cached, every
+ * element is synthesized again instead of copied from the glyph cache.
+ */
+static void benchRender(const QByteArray &text, bool impaired, bool cached=true)
+{
+	GenerateMorse gen;
+	gen.setWpm(20);
+	gen.appendText(text, GenerateMorse::SubstituteUnknown);
+	QList<int> elements = gen.elements();
+
+	QFile null("/dev/null");
+	if (!null.open(QIODevice::WriteOnly))
+		return;
+
+	RenderMorse render;
+	render.setGlyphCache(cached);
+	ImpairmentChain chain;
+	if (impaired) {
+		chain.append(new FadingStage(FadingStage::Rayleigh, 0.2));
+		chain.append(new NoiseStage(NoiseStage::Pink, 0.05));
+		chain.append(new QrnStage(0.5, 0.3));
+		chain.append(new BandpassStage(800, 500));
+		render.setImpairments(&chain);
+	}
+	QElapsedTimer timer;
+	timer.start();
+	qint64 samples = render.render(elements, gen.timing(), &null);
+	qint64 ns = timer.nsecsElapsed();
+
+	double secs = (double)samples / SAMPLE_RATE;
+	printf("render()%s%s: %.1f min audio in %.1f ms, %.0fx realtime\n",
+	       impaired ? " with impairments" : "",
+	       cached ? "" : " without cache",
+	       secs / 60, ns / 1e6, secs * 1e9 / ns);
+}
+
+
+/*!
+ * \brief Decode noisy audio of \a text with \a channels DecodeAudio
+ *
+ * All decoders get the same samples, like a receiver with many channels
+ * of the same band. Prints how many such channels one core can decode
+ * in realtime.
+ */
+static void benchAudio(const QByteArray &text, int channels)
+{
+	GenerateMorse gen;
+	gen.setWpm(25);
+	gen.appendText(text, GenerateMorse::SubstituteUnknown);
+	// Start with a pause, so the decoders can hear the noise first
+	QList<int> elements;
+	elements.append(-7);
+	elements += gen.elements();
+
+	QBuffer pcm;
+	pcm.open(QIODevice::WriteOnly);
+	RenderMorse render(700);
+	ImpairmentChain chain;
+	chain.append(new NoiseStage(NoiseStage::White, 0.2));
+	render.setImpairments(&chain);
+	qint64 samples = render.render(elements, gen.timing(), &pcm);
+
+	QList<DecodeAudio *> decoders;
+	for (int i = 0; i < channels; i++)
+		decoders.append(new DecodeAudio(700));
+
+	QElapsedTimer timer;
+	timer.start();
+	foreach(DecodeAudio *dec, decoders) {
+		dec->process((const qint16 *)pcm.data().constData(), samples);
+		dec->flush();
+	}
+	qint64 ns = timer.nsecsElapsed();
+
+	double secs = (double)samples / SAMPLE_RATE;
+	printf("DecodeAudio: %s...\n", qPrintable(decoders.first()->text().left(60)));
+	printf("DecodeAudio, %d channels: %.1f min audio in %.1f ms, %.0f channels per core\n",
+	       channels, secs / 60, ns / 1e6, secs * 1e9 * channels / ns);
+	qDeleteAll(decoders);
+}
+
+
+/*!
+ * \brief Levenshtein distance between \a a and \a b
+ */
+static int editDistance(const QString &a, const QString &b)
+{
+	QVector<int> row(b.size() + 1);
+	for (int j = 0; j <= b.size(); j++)
+		row[j] = j;
+	for (int i = 1; i <= a.size(); i++) {
+		int diag = row[0];
+		row[0] = i;
+		for (int j = 1; j <= b.size(); j++) {
+			int up = row[j];
+			row[j] = qMin(qMin(row[j] + 1, row[j - 1] + 1),
+			              diag + (a.at(i - 1) == b.at(j - 1) ? 0 : 1));
+			diag = up;
+		}
+	}
+	return row[b.size()];
+}
+
+
+/*!
+ * \brief Text that the bigrams of \ref benchViterbi() are learned from
+ *
+ * Some plain English and what hams send in a contact. It's not the text
+ * that gets decoded, otherwise the bigrams would already know the answer.
+ */
+static const char corpus[] =
+	"cq cq cq de dl1abc dl1abc dl1abc pse k "
+	"dl1abc de g4xyz ga om tnx fer call ur rst 579 579 name is john john qth is "
+	"leeds leeds hw cpy? dl1abc de g4xyz k "
+	"g4xyz de dl1abc r fb john tnx fer rprt ur rst 599 599 name is peter qth near "
+	"munich rig is a small transceiver at 100 watts and the antenna is a dipole up "
+	"ten meters wx here is sunny and warm so hw? g4xyz de dl1abc k "
+	"fb peter all copied solid the weather in england is cold and wet today "
+	"i have been a radio amateur for twenty years and still enjoy morse best "
+	"many thanks for the nice contact hope to meet you again on the bands "
+	"73 and good dx dl1abc de g4xyz sk "
+	"it was the first warm day of spring and the people of the town came out "
+	"into the streets to enjoy the sun the children played in the park while "
+	"their parents sat on the benches and talked about the long winter that was "
+	"now behind them an old man walked slowly along the river with his dog and "
+	"stopped now and then to watch the boats go by he remembered the days when "
+	"he had worked on those boats himself carrying coal and grain up and down "
+	"the river from morning until night it had been hard work but he had liked "
+	"it and he still missed the sound of the engines and the smell of the water "
+	"qrz? de ok2abc ok2abc k "
+	"ok2abc de ea8xyz 5nn 14 bk "
+	"r tu 5nn 15 ea8xyz de ok2abc bk "
+	"tu 73 gl de ea8xyz ee ";
+
+
+/*!
+ * \brief Compare the threshold decoder with \ref DecodeViterbi
+ *
+ * Renders \a text at 25 WpM with white noise of \a noise, and with
+ * \a fading also Rayleigh fading. Each decoder prints how much of the
+ * text it got wrong, as character error rate, and how much faster than
+ * realtime it is. The bigrams are learned from \ref corpus, not from
+ * the sent text.
+ */
+static void benchViterbi(const QByteArray &text, float noise, float fading)
+{
+	GenerateMorse gen;
+	gen.setWpm(25);
+	gen.appendText(text, GenerateMorse::SubstituteUnknown);
+	QList<int> elements;
+	elements.append(-7);
+	elements += gen.elements();
+	QString ref = DecodeMorse::decode(gen.elements());
+
+	QBuffer pcm;
+	pcm.open(QIODevice::WriteOnly);
+	RenderMorse render(700);
+	ImpairmentChain chain;
+	if (fading)
+		chain.append(new FadingStage(FadingStage::Rayleigh, fading));
+	chain.append(new NoiseStage(NoiseStage::White, noise));
+	render.setImpairments(&chain);
+	qint64 samples = render.render(elements, gen.timing(), &pcm);
+	const qint16 *frames = (const qint16 *)pcm.data().constData();
+
+	QVector<float> bigrams = DecodeViterbi::bigrams(QString::fromLatin1(corpus));
+	const char *names[] = { "threshold", "viterbi", "+bigrams" };
+	printf("noise %.1f, fading %.1f:", noise, fading);
+	for (int mode = 0; mode < 3; mode++) {
+		DecodeAudio dec(700);
+		if (mode)
+			dec.setViterbi(32, mode == 2 ? bigrams : QVector<float>());
+		QElapsedTimer timer;
+		timer.start();
+		dec.process(frames, samples);
+		dec.flush();
+		qint64 ns = timer.nsecsElapsed();
+
+		QString out = dec.text().trimmed();
+		double secs = (double)samples / SAMPLE_RATE;
+		printf("  %s %4.1f%% %5.0fx", names[mode],
+		       100.0 * editDistance(ref, out) / ref.size(), secs * 1e9 / ns);
+	}
+	printf("\n");
+}
+
+
+/*!
+ * \brief Skim \a stations signals that stop one after the other
+ *
+ * Each station calls CQ at it's own pitch and speed, the first one
+ * once, the next ones more often. All text is taken once at the end,
+ * long after most of them went quiet. Prints how much of each station's
+ * text got lost, how many spots are on no station's pitch, and how much
+ * faster than realtime the \ref Skimmer is.
+ */
+static void benchSkimmer(int stations)
+{
+	QVector<float> mix;
+	QStringList refs;
+	for (int i = 0; i < stations; i++) {
+		GenerateMorse gen;
+		gen.setWpm(18 + 3 * i);
+		QByteArray text;
+		for (int r = 0; r <= 2 * i; r++) {
+			text += "cq cq de dl";
+			text += QByteArray::number(i);
+			text += "abc k ";
+		}
+		gen.appendText(text, GenerateMorse::SubstituteUnknown);
+		refs.append(DecodeMorse::decode(gen.elements()).trimmed());
+		QList<int> elements;
+		elements.append(-7);
+		elements += gen.elements();
+
+		QBuffer pcm;
+		pcm.open(QIODevice::WriteOnly);
+		RenderMorse render(500 + 300 * i);
+		qint64 samples = render.render(elements, gen.timing(), &pcm);
+		const qint16 *frames = (const qint16 *)pcm.data().constData();
+		if (mix.size() < samples)
+			mix.resize(samples);
+		for (qint64 n = 0; n < samples; n++)
+			mix[n] += frames[n] / 32768.0f / stations;
+	}
+	// Some silence at the end, the last one stops long before the text is taken
+	mix.resize(mix.size() + 10 * SAMPLE_RATE);
+	NoiseStage noise(NoiseStage::White, 0.01);
+	noise.setSampleRate(SAMPLE_RATE);
+	noise.process(mix.data(), mix.size());
+
+	Skimmer skim;
+	QElapsedTimer timer;
+	timer.start();
+	skim.process(mix.constData(), mix.size());
+	skim.flush();
+	QList<Skimmer::Spot> spots = skim.takeText();
+	qint64 ns = timer.nsecsElapsed();
+
+	// Spots that are no station's are decoded noise
+	int stray = spots.size();
+	printf("Skimmer, %d stations:", stations);
+	for (int i = 0; i < stations; i++) {
+		QString out;
+		foreach(const Skimmer::Spot &spot, spots) {
+			if (qAbs(spot.freq - (500 + 300 * i)) <= skim.binHz() / 2) {
+				out += (out.isEmpty() ? "" : " ") + spot.text;
+				stray--;
+			}
+		}
+		printf("  %d Hz %4.1f%%", 500 + 300 * i,
+		       100.0 * editDistance(refs[i], out) / refs[i].size());
+	}
+	double secs = (double)mix.size() / SAMPLE_RATE;
+	printf(", %d other spots, %.0f s audio, %.0fx realtime\n",
+	       stray, secs, secs * 1e9 / ns);
+}
+
+
+/*!
+ * \brief Decode the key presses of a sloppy human sending \a text
+ *
+ * The speed goes from 15 to 30 WpM and back, dahs are 3.5 dits long,
+ * gaps between characters and words are stretched and every length is
+ * off by up to 20%. \a streams decoders get the same key presses, like
+ * a server with many keyers. Prints how many of them one core can run.
+ */
+static void benchKeying(const QByteArray &text, int streams)
+{
+	GenerateMorse gen;
+	gen.appendText(text, GenerateMorse::SubstituteUnknown);
+
+	// Times of key down and key up, in turns
+	QVector<qint64> events;
+	double t = 1000;
+	foreach(int e, gen.elements()) {
+		double unit = 60000.0 / 50 / (22.5 - 7.5 * cos(t / 60000));
+		double len = e == 3 ? 3.5 : e == -3 ? 4.5 : e == -7 ? 10 : 1;
+		len *= unit * (0.8 + 0.4 * qrand() / RAND_MAX);
+		if (e > 0)
+			events.append((qint64)t);
+		t += len;
+		if (e > 0)
+			events.append((qint64)t);
+	}
+
+	QList<DecodeKeying *> decoders;
+	for (int i = 0; i < streams; i++)
+		decoders.append(new DecodeKeying());
+
+	QElapsedTimer timer;
+	timer.start();
+	foreach(DecodeKeying *dec, decoders) {
+		for (int i = 0; i < events.size(); i += 2) {
+			dec->keyDown(events[i]);
+			dec->keyUp(events[i + 1]);
+		}
+		dec->flush();
+	}
+	qint64 ns = timer.nsecsElapsed();
+
+	double secs = t / 1000;
+	printf("DecodeKeying: %s...\n", qPrintable(decoders.first()->text().left(60)));
+	printf("DecodeKeying, %d streams: %.1f min keying in %.1f ms, %.0f streams per core\n",
+	       streams, secs / 60, ns / 1e6, secs * 1e9 * streams / ns);
+	qDeleteAll(decoders);
+}
+
+
+/*!
+ * \brief Mix \a stations keyed sources into a \ref NullSink
+ *
+ * This is the whole live path without a sound card, at 48 kHz float
+ * stereo. Prints how much faster than realtime this is.
+ */
+static void benchSink(int stations)
+{
+	AudioMixer mixer(0);
+	for (int i = 0; i < stations; i++)
+		mixer.addSource(500 + 23 * i, 0.5 / stations, (i % 5 - 2) / 2.0)->playSound(3600000);
+
+	NullSink sink;
+	int rate = 48000;
+	int channels = 2;
+	SineSource::SampleType type = SineSource::Float32;
+	sink.negotiate(rate, channels, type);
+	mixer.setFormat(rate, channels, type);
+	sink.setRealtime(false);
+	sink.start(&mixer);
+
+	QElapsedTimer timer;
+	timer.start();
+	sink.pump(rate * 60);
+	qint64 ns = timer.nsecsElapsed();
+
+	double secs = (double)sink.frames() / rate;
+	printf("NullSink, %d stations: %.0f s audio in %.1f ms, %.0fx realtime\n",
+	       stations, secs, ns / 1e6, secs * 1e9 / ns);
+}
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	loadChars("../characters.csv");
+
+	QStringList signs;
+	foreach(MorseCharacter m, chars)
+		if (!m.sign.isEmpty())
+			signs.append(m.sign);
+	printf("%d signs, %d rounds\n\n", signs.count(), rounds);
+
+	Morse::setOverlay(true);
+	printf("lookup, chars overlay:   %8.1f ns\n", benchLookup(signs));
+	Morse::setOverlay(false);
+	printf("lookup, static table:    %8.1f ns\n", benchLookup(signs));
+	printf("Morse::lookup():         %8.1f ns\n", benchStatic(signs));
+	printf("\n");
+	printf("append(), per character: %8.1f ns\n", benchEncode(false));
+	printf("same, compact mode:      %8.1f ns\n", benchEncode(true));
+	printf("\n");
+
+	QByteArray text;
+	while (text.size() < 8 * 1024 * 1024)
+		text.append("The quick brown fox jumps over the lazy dog. 73 de dh3hs AR\n");
+	benchBulk(text, false);
+	benchBulk(text, true);
+	printf("\n");
+	benchDecode(text.left(1024 * 1024));
+	benchRender(text.left(16 * 1024), false, false);
+	benchRender(text.left(16 * 1024), false);
+	benchRender(text.left(16 * 1024), true);
+	benchSink(1);
+	benchSink(50);
+	benchAudio(text.left(4 * 1024), 100);
+	benchKeying(text.left(16 * 1024), 100);
+	benchViterbi(text.left(2 * 1024), 0.5, 0);
+	benchViterbi(text.left(2 * 1024), 1.0, 0);
+	benchViterbi(text.left(2 * 1024), 1.2, 0);
+	benchViterbi(text.left(2 * 1024), 1.5, 0);
+	benchViterbi(text.left(2 * 1024), 0.3, 0.2);
+	benchSkimmer(5);
+
+	for (int i = 1; i < argc; i++)
+		benchFile(argv[i]);
+
+	return 0;
+}
@@ -0,0 +1,801 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Listens to morse in audio samples and writes down the clear text.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QFile>
+#include <QtEndian>
+#include <math.h>
+#include <stdio.h>
+#include "decode_audio.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/*!
+ * \brief Length of one detector block in milliseconds
+ *
+ * Shorter blocks measure the tones more exactly, longer blocks make the
+ * detector narrower, so it hears less noise. 4 ms are still 7 blocks for
+ * a dit at 40 WpM, and give a band width of about 500 Hz.
+ */
+#define BLOCK_MS 4
+
+
+/*!
+ * \brief Frames per read in \ref DecodeAudio::decode()
+ */
+#define CHUNK 4096
+
+
+/*!
+ * \brief Time in which the signal level falls to 1/e while nothing is keyed
+ */
+#define SIGNAL_FALL_MS 2000.0
+
+
+/*!
+ * \brief Time over which the noise level is averaged
+ */
+#define NOISE_MS 100.0
+
+
+/*!
+ * \brief Time over which the signal level is averaged while keyed
+ */
+#define SIGNAL_MS 20.0
+
+
+/*!
+ * \brief Signal must be this much louder than the noise to key
+ *
+ * Otherwise the decoder would type noise after a long pause, when the
+ * signal level has fallen down to the noise.
+ */
+#define MIN_SNR 2.5f
+
+
+/*!
+ * \brief Tones shorter than this part of a dit are clicks, not dits
+ */
+#define GLITCH 0.3f
+
+
+/*!
+ * \brief Tones shorter than this are clicks, no matter how long a dit is
+ *
+ * Tones longer than this are never clicks. Otherwise the dits of a fast
+ * sender would be thrown away before the decoder learned the speed.
+ */
+#define GLITCH_MS 8.0f
+
+
+/*!
+ * \brief Correlate \a n samples of \a x with two tables at once
+ *
+ * This is one bin of a DFT, like the Goertzel algorithm computes it. But
+ * unlike the Goertzel recursion, it vectorizes: there's no dependency from
+ * one sample to the next.
+ */
+static void correlate(const float *x, const float *c, const float *s, int n, float *re, float *im)
+{
+	float r = 0;
+	float m = 0;
+	int i = 0;
+#if defined(__SSE2__)
+	__m128 vr = _mm_setzero_ps();
+	__m128 vi = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_loadu_ps(x + i);
+		vr = _mm_add_ps(vr, _mm_mul_ps(v, _mm_loadu_ps(c + i)));
+		vi = _mm_add_ps(vi, _mm_mul_ps(v, _mm_loadu_ps(s + i)));
+	}
+	float tr[4], ti[4];
+	_mm_storeu_ps(tr, vr);
+	_mm_storeu_ps(ti, vi);
+	r = tr[0] + tr[1] + tr[2] + tr[3];
+	m = ti[0] + ti[1] + ti[2] + ti[3];
+#endif
+	for (; i < n; i++) {
+		r += x[i] * c[i];
+		m += x[i] * s[i];
+	}
+	*re = r;
+	*im = m;
+}
+
+
+/*!
+ * \brief Creates a decoder that gets one level every \a _blockMs
+ */
+DecodeLevel::DecodeLevel(float _blockMs)
+	: blockMs(_blockMs)
+	, dit(1)
+	, viterbi(0)
+{
+	setWpm(20);
+	clear();
+}
+
+
+DecodeLevel::~DecodeLevel()
+{
+	delete viterbi;
+}
+
+
+/*!
+ * \brief Decode with a \ref DecodeViterbi that keeps \a beam readings
+ *
+ * It finds more of the text in a weak or fading signal, but costs more
+ * time, and the text comes a few characters later. A \a beam of 0
+ * switches back to the thresholds. \a bigrams come from \ref
+ * DecodeViterbi::bigrams(), they're optional.
+ *
+ * The text so far is lost.
+ */
+void DecodeLevel::setViterbi(int beam, const QVector<float> &bigrams)
+{
+	if (beam <= 0) {
+		delete viterbi;
+		viterbi = 0;
+	} else {
+		if (!viterbi)
+			viterbi = new DecodeViterbi(beam);
+		viterbi->setBeam(beam);
+		viterbi->setBigrams(bigrams);
+	}
+	clear();
+}
+
+
+/*!
+ * \brief Set the time between two calls of \ref level()
+ *
+ * The learned speed stays.
+ */
+void DecodeLevel::setBlockMs(float ms)
+{
+	dit = dit * blockMs / ms;
+	blockMs = ms;
+}
+
+
+/*!
+ * \brief Set the speed to start with
+ *
+ * The decoder follows the speed of the sender by itself, this only
+ * makes the first characters come out right.
+ */
+void DecodeLevel::setWpm(float wpm)
+{
+	// PARIS is 50 dits long
+	dit = 60000.0f / 50 / wpm / blockMs;
+}
+
+
+/*!
+ * \brief Returns the speed that the decoder currently hears
+ */
+float DecodeLevel::wpm() const
+{
+	return 60000.0f / 50 / (dit * blockMs);
+}
+
+
+/*!
+ * \brief Forget the text and everything that was heard
+ *
+ * The speed stays.
+ */
+void DecodeLevel::clear()
+{
+	blocks = 0;
+	signal = 0;
+	noise = 0;
+	down = false;
+	run = 0;
+	lastGap = 0;
+	lastTone = 0;
+	charDone = true;
+	wordDone = true;
+	charStart = 0;
+	starts.clear();
+	slotSignal.clear();
+	slotNoise.clear();
+	firstSlot = 0;
+	morse.clear();
+	if (viterbi)
+		viterbi->clear();
+}
+
+
+/*!
+ * \brief Return the decoded text and start over
+ *
+ * A character that isn't finished yet stays.
+ */
+QString DecodeLevel::takeText()
+{
+	starts.clear();
+	return viterbi ? viterbi->takeText() : morse.takeText();
+}
+
+
+/*!
+ * \brief Returns when character \a i of \ref text() started
+ *
+ * In milliseconds since \ref clear(). A space gets the time when the gap
+ * got long enough to end the word, or with \ref setViterbi() when it
+ * started.
+ */
+qint64 DecodeLevel::charMs(int i) const
+{
+	qint64 block = viterbi ? viterbi->charStamp(i) : starts.at(i);
+	return (qint64)(block * blockMs + 0.5f);
+}
+
+
+/*!
+ * \brief Returns the milliseconds given to \ref level() since \ref clear()
+ */
+qint64 DecodeLevel::ms() const
+{
+	return (qint64)(blocks * blockMs + 0.5f);
+}
+
+
+/*!
+ * \brief Index in the level history of the slot at \a ms
+ *
+ * Times that are gone or still to come get the first or last slot.
+ */
+int DecodeLevel::slotAt(qint64 ms) const
+{
+	return qBound((qint64)0, ms / slotMs - firstSlot, (qint64)slotSignal.size() - 1);
+}
+
+
+/*!
+ * \brief Highest level of the signal in the slot at \a ms
+ *
+ * Like \ref charMs(), the time is in milliseconds since \ref clear().
+ * The history of the levels is kept until \ref dropLevels(), so that the
+ * level of a word can be looked up long after it was heard.
+ */
+float DecodeLevel::signalAt(qint64 ms) const
+{
+	if (slotSignal.isEmpty())
+		return signal;
+	return slotSignal.at(slotAt(ms));
+}
+
+
+/*!
+ * \brief Level of the noise at \a ms, see \ref signalAt()
+ */
+float DecodeLevel::noiseAt(qint64 ms) const
+{
+	if (slotNoise.isEmpty())
+		return noise;
+	return slotNoise.at(slotAt(ms));
+}
+
+
+/*!
+ * \brief Forget the history of the levels before \a ms
+ */
+void DecodeLevel::dropLevels(qint64 ms)
+{
+	int n = slotAt(ms);
+	if (n <= 0)
+		return;
+	slotSignal.remove(0, n);
+	slotNoise.remove(0, n);
+	firstSlot += n;
+}
+
+
+/*!
+ * \brief The stream ended, finish the current character
+ */
+void DecodeLevel::flush()
+{
+	if (down)
+		keyed(false);
+	if (viterbi) {
+		// The gap since the last tone is run blocks long
+		viterbi->flush(blocks - run);
+		wordDone = true;
+	}
+	morse.endChar();
+	charDone = true;
+	stamp();
+}
+
+
+/*!
+ * \brief Decide for one block if the key is down
+ *
+ * The levels of signal and noise are followed separately. The signal
+ * level jumps up with every louder block, but falls slowly, so that it's
+ * still known after a pause. The noise is averaged while the key is up.
+ * The threshold lies in between, a bit higher for key down than for key
+ * up, so that the key doesn't chatter.
+ *
+ * @param l  level of the tone in this block, any unit
+ */
+void DecodeLevel::level(float l)
+{
+	// The first blocks only teach the noise level, as their average
+	bool learning = blocks * blockMs < NOISE_MS;
+	if (learning)
+		noise = (noise * blocks + l) / (blocks + 1);
+	else if (!down)
+		noise += (l - noise) * blockMs / NOISE_MS;
+	if (l > signal)
+		signal += (l - signal) * 0.5f;
+	else if (down)
+		signal += (l - signal) * blockMs / SIGNAL_MS;
+	else
+		signal += (noise - signal) * blockMs / SIGNAL_FALL_MS;
+
+	// The loudest level of each slot, and the noise when it started
+	qint64 slot = (qint64)(blocks * blockMs) / slotMs - firstSlot;
+	if (slot < slotSignal.size())
+		slotSignal.last() = qMax(slotSignal.last(), signal);
+	while (slotSignal.size() <= slot) {
+		slotSignal.append(signal);
+		slotNoise.append(noise);
+	}
+
+	bool on = false;
+	if (!learning && signal > noise * MIN_SNR)
+		on = l > noise + (signal - noise) * (down ? 0.4f : 0.6f);
+	if (on != down)
+		keyed(on);
+
+	blocks++;
+	run++;
+	if (!down && !wordDone && viterbi) {
+		// Surely the end of a word. Shorter gaps go to the decoder with
+		// the next tone, when their length is known.
+		if (run > 10 * dit) {
+			viterbi->gap(run / dit, blocks - run, true);
+			charDone = true;
+			wordDone = true;
+		}
+	} else if (!down && !wordDone) {
+		// Gaps end characters and words as soon as they're long enough,
+		// so that live text comes out without waiting for the next tone
+		if (!charDone && run > 2 * dit) {
+			morse.endChar();
+			charDone = true;
+			stamp();
+		}
+		if (run > 5 * dit) {
+			morse.endWord();
+			wordDone = true;
+			stamp();
+		}
+	}
+}
+
+
+/*!
+ * \brief The key went down (\a on) or up
+ *
+ * When it goes up, the tone is a dit if it's shorter than two dits, and a
+ * dah otherwise. Each tone moves the estimated dit length a bit towards
+ * what it heard, a dah counts as three dits.
+ *
+ * That alone can get stuck when the start value is far off, e.g. when
+ * all tones are shorter than two estimated dits. So when one of two
+ * tones in a row is much longer than the other, they must be a dit and a
+ * dah, and the estimate jumps towards them.
+ */
+void DecodeLevel::keyed(bool on)
+{
+	if (on) {
+		lastGap = run;
+		run = 0;
+		down = true;
+		return;
+	}
+
+	down = false;
+	if (run < qMin(dit * GLITCH, GLITCH_MS / blockMs)) {
+		// A click, the gap before simply goes on
+		run += lastGap;
+		return;
+	}
+	if (lastTone) {
+		float lo = qMin(run, lastTone);
+		float hi = qMax(run, lastTone);
+		if (hi > 2 * lo)
+			dit += ((lo + hi / 3) / 2 - dit) * 0.5f;
+	}
+	lastTone = run;
+	if (charDone)
+		charStart = blocks - run;
+
+	if (viterbi) {
+		// The gap before is over, unless it already ended the word
+		if (!wordDone)
+			viterbi->gap(lastGap / dit, blocks - run - lastGap);
+		viterbi->tone(run / dit, blocks - run);
+	}
+	if (run < 2 * dit) {
+		if (!viterbi)
+			morse.dit();
+		dit += (run - dit) * 0.2f;
+	} else {
+		if (!viterbi)
+			morse.dah();
+		dit += (run / 3.0f - dit) * 0.2f;
+	}
+	// Between 3 and 100 WpM
+	dit = qBound(12 / blockMs, dit, 400 / blockMs);
+	run = 0;
+	charDone = false;
+	wordDone = false;
+}
+
+
+/*!
+ * \brief Note the start of the characters that \ref morse just added
+ */
+void DecodeLevel::stamp()
+{
+	const QString &out = morse.text();
+	while (starts.size() < out.size())
+		starts.append(out.at(starts.size()) == ' ' ? blocks : charStart);
+}
+
+
+
+/*!
+ * \brief Creates a decoder
+ *
+ * @param _freq        pitch of the morse tone in Hz
+ * @param sampleRate   samples per second
+ */
+DecodeAudio::DecodeAudio(int _freq, int sampleRate)
+	: freq(_freq)
+	, rate(sampleRate)
+	, channels(1)
+	, blockLen(0)
+{
+	MYTRACE("DecodeAudio::DecodeAudio(%d, %d)", _freq, sampleRate);
+
+	makeTables();
+	clear();
+}
+
+
+/*!
+ * \brief Set the pitch of the tone to listen to
+ */
+void DecodeAudio::setFreq(int _freq)
+{
+	freq = _freq;
+	makeTables();
+}
+
+
+/*!
+ * \brief Set the format of the samples
+ *
+ * \ref decode() of a WAV file sets this from the header. Raw samples
+ * are read in this format, 16 bit little endian.
+ *
+ * @param sampleRate  samples per second
+ * @param chans       channels per frame, they get mixed to mono
+ */
+void DecodeAudio::setFormat(int sampleRate, int chans)
+{
+	rate = sampleRate;
+	channels = qMax(chans, 1);
+	makeTables();
+}
+
+
+/*!
+ * \brief Compute the tables of the tone detector
+ *
+ * The tables hold a Hann window times a cosine and a sine at the pitch.
+ * The window keeps loud signals on other pitches out. They're scaled so
+ * that a sine with amplitude 1.0 gives a level of about 1.0.
+ */
+void DecodeAudio::makeTables()
+{
+	int len = rate * BLOCK_MS / 1000;
+	// Full SIMD steps only
+	len = qMax((len + 3) & ~3, 16);
+	if (len != blockLen) {
+		blockLen = len;
+		pending.resize(blockLen);
+		fill = 0;
+	}
+	cosTab.resize(blockLen);
+	sinTab.resize(blockLen);
+	double w = 2 * M_PI * freq / rate;
+	float scale = 4.0f / blockLen;
+	for (int i = 0; i < blockLen; i++) {
+		double win = 0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / blockLen);
+		cosTab[i] = win * cos(w * i) * scale;
+		sinTab[i] = win * sin(w * i) * scale;
+	}
+	setBlockMs(blockLen * 1000.0f / rate);
+}
+
+
+/*!
+ * \brief Forget the text and everything that was heard
+ *
+ * The speed and the format stay.
+ */
+void DecodeAudio::clear()
+{
+	DecodeLevel::clear();
+	fill = 0;
+	frameCount = 0;
+	carry.clear();
+	dataLeft = -1;
+}
+
+
+/*!
+ * \brief Returns the number of frames decoded since \ref clear()
+ */
+qint64 DecodeAudio::frames() const
+{
+	return frameCount;
+}
+
+
+/*!
+ * \brief Decode \a n mono samples, where 1.0 is full scale
+ */
+void DecodeAudio::process(const float *samples, int n)
+{
+	frameCount += n;
+	while (n > 0) {
+		// Whole blocks are used in place
+		if (!fill && n >= blockLen) {
+			detect(samples);
+			samples += blockLen;
+			n -= blockLen;
+			continue;
+		}
+		int len = qMin(n, blockLen - fill);
+		memcpy(pending.data() + fill, samples, len * sizeof(float));
+		fill += len;
+		samples += len;
+		n -= len;
+		if (fill == blockLen) {
+			detect(pending.constData());
+			fill = 0;
+		}
+	}
+}
+
+
+/*!
+ * \brief Decode \a n frames of 16 bit samples
+ *
+ * The frames have as many channels as set with \ref setFormat(), they're
+ * in the byte order of the machine.
+ */
+void DecodeAudio::process(const qint16 *frames, int n)
+{
+	float buf[CHUNK];
+	while (n > 0) {
+		int len = qMin(n, CHUNK);
+		toFloat(frames, len, channels, buf);
+		process(buf, len);
+		frames += len * channels;
+		n -= len;
+	}
+}
+
+
+/*!
+ * \brief Convert \a n frames of 16 bit samples into mono float
+ *
+ * Frames with more than one channel get mixed. 1.0 is full scale.
+ */
+void DecodeAudio::toFloat(const qint16 *frames, int n, int chans, float *out)
+{
+	int i = 0;
+	if (chans == 1) {
+#if defined(__SSE2__)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 scale = _mm_set1_ps(1.0f / 32768);
+		for (; i + 8 <= n; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(frames + i));
+			__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, x), 16));
+			__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, x), 16));
+			_mm_storeu_ps(out + i, _mm_mul_ps(lo, scale));
+			_mm_storeu_ps(out + i + 4, _mm_mul_ps(hi, scale));
+		}
+#endif
+		for (; i < n; i++)
+			out[i] = frames[i] * (1.0f / 32768);
+		return;
+	}
+
+	float scale = 1.0f / 32768 / chans;
+	for (; i < n; i++) {
+		int sum = 0;
+		for (int c = 0; c < chans; c++)
+			sum += frames[i * chans + c];
+		out[i] = sum * scale;
+	}
+}
+
+
+/*!
+ * \brief Decode all samples that \a in has right now
+ *
+ * If the first bytes after \ref clear() are a WAV header, the format is
+ * taken from it, and whatever follows the samples is ignored. Otherwise
+ * the samples are raw, see \ref setFormat().
+ *
+ * Call this again when a live device has more data, e.g. on it's
+ * readyRead() signal.
+ *
+ * @returns number of frames decoded, or -1 if the WAV header is bad
+ */
+qint64 DecodeAudio::decode(QIODevice *in)
+{
+	if (!frameCount && !fill && carry.isEmpty() && in->peek(4) == "RIFF") {
+		int r, c;
+		if (!readWavHeader(in, &r, &c, &dataLeft))
+			return -1;
+		setFormat(r, c);
+	}
+
+	int frameBytes = channels * 2;
+	QByteArray buf;
+	buf.resize(CHUNK * frameBytes);
+	qint64 done = 0;
+	while (dataLeft) {
+		// A frame that was cut in two by the last read comes first
+		int have = carry.size();
+		memcpy(buf.data(), carry.constData(), have);
+		qint64 want = buf.size() - have;
+		if (dataLeft > 0)
+			want = qMin(want, dataLeft);
+		qint64 len = in->read(buf.data() + have, want);
+		if (len <= 0)
+			break;
+		if (dataLeft > 0)
+			dataLeft -= len;
+		len += have;
+		int n = len / frameBytes;
+		carry = QByteArray(buf.constData() + n * frameBytes, len - n * frameBytes);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+		qint16 *p = (qint16 *)buf.data();
+		for (int i = 0; i < n * channels; i++)
+			p[i] = qFromLittleEndian(p[i]);
+#endif
+		process((const qint16 *)buf.constData(), n);
+		done += n;
+	}
+	return done;
+}
+
+
+/*!
+ * \brief Decode a whole file, "-" is stdin
+ *
+ * @returns false if the file can't be read
+ */
+bool DecodeAudio::decodeFile(const QString &fname)
+{
+	MYTRACE("DecodeAudio::decodeFile(%s)", qPrintable(fname));
+
+	QFile file(fname);
+	bool ok;
+	if (fname == "-")
+		ok = file.open(stdin, QIODevice::ReadOnly);
+	else
+		ok = file.open(QIODevice::ReadOnly);
+	if (!ok) {
+		qWarning("Can't read %s", qPrintable(fname));
+		return false;
+	}
+	if (decode(&file) < 0) {
+		qWarning("%s: unsupported WAV format", qPrintable(fname));
+		return false;
+	}
+	flush();
+	return true;
+}
+
+
+/*!
+ * \brief Read the header of a WAV file up to the samples
+ *
+ * Only 16 bit PCM is supported, that's what \ref RenderMorse writes and
+ * what most recorders write.
+ *
+ * Chunks after the samples, e.g. LIST or id3, aren't audio. So stop
+ * reading after \a dataBytes. Writers that stream to a pipe don't know
+ * the size yet and write 0 or 0xffffffff, then it's -1.
+ *
+ * @returns false if it's not such a WAV file
+ */
+bool DecodeAudio::readWavHeader(QIODevice *in, int *sampleRate, int *chans, qint64 *dataBytes)
+{
+	QByteArray riff = in->read(12);
+	if (riff.size() != 12 || !riff.startsWith("RIFF") || riff.mid(8) != "WAVE")
+		return false;
+
+	bool haveFormat = false;
+	for (;;) {
+		QByteArray head = in->read(8);
+		if (head.size() != 8)
+			return false;
+		quint32 size = qFromLittleEndian<quint32>((const uchar *)head.constData() + 4);
+		if (head.startsWith("data")) {
+			if (dataBytes)
+				*dataBytes = size && size != 0xffffffff ? (qint64)size : -1;
+			return haveFormat;
+		}
+
+		// Chunks are padded to an even size
+		QByteArray chunk = in->read(size + (size & 1));
+		if ((quint32)chunk.size() < size)
+			return false;
+		if (head.startsWith("fmt ") && size >= 16) {
+			const uchar *p = (const uchar *)chunk.constData();
+			quint16 tag = qFromLittleEndian<quint16>(p);
+			quint16 bits = qFromLittleEndian<quint16>(p + 14);
+			// 0xfffe is WAVE_FORMAT_EXTENSIBLE, it's still PCM here
+			if ((tag != 1 && tag != 0xfffe) || bits != 16)
+				return false;
+			*chans = qFromLittleEndian<quint16>(p + 2);
+			*sampleRate = qFromLittleEndian<quint32>(p + 4);
+			haveFormat = *chans > 0 && *sampleRate > 0;
+		}
+	}
+}
+
+
+/*!
+ * \brief Measure the tone in one block and pass it on to \ref level()
+ */
+void DecodeAudio::detect(const float *block)
+{
+	float re, im;
+	correlate(block, cosTab.constData(), sinTab.constData(), blockLen, &re, &im);
+	level(sqrtf(re * re + im * im));
+}
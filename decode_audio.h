@@ -0,0 +1,163 @@
+#ifndef DECODE_AUDIO_H
+#define DECODE_AUDIO_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "decode_morse.h"
+#include "decode_viterbi.h"
+#include "sinesource.h"
+
+
+class QIODevice;
+
+
+/*!
+ * \brief Decodes morse from the level of a tone, one level per block
+ *
+ * Something else measures how loud the tone is, e.g. \ref DecodeAudio or
+ * one bin of \ref Skimmer, and calls \ref level() once per block. A
+ * threshold, which follows the level of the signal and of the noise,
+ * tells if the key is down. The lengths of the tones and gaps are then
+ * measured in dits (like the 1, 3 and 7 of \ref GenerateMorse) and fed
+ * into \ref DecodeMorse, which knows the characters.
+ *
+ * The speed doesn't need to be known, the length of a dit is learned
+ * from the tones. \ref setWpm() only gives a start value.
+ *
+ * With \ref setViterbi(), the lengths go to \ref DecodeViterbi instead,
+ * which doesn't decide at once but finds the most likely text.
+ */
+class DecodeLevel {
+public:
+	DecodeLevel(float blockMs=4);
+	~DecodeLevel();
+	void setBlockMs(float ms);
+	void setWpm(float wpm);
+	float wpm() const;
+	void setViterbi(int beam, const QVector<float> &bigrams=QVector<float>());
+
+	void level(float level);
+	void flush();
+
+	void clear();
+	/*! \brief What's decoded so far */
+	const QString &text() const { return viterbi ? viterbi->text() : morse.text(); }
+	QString takeText();
+	qint64 charMs(int i) const;
+	/*! \brief Returns true while the key is down */
+	bool keyDown() const { return down; }
+	/*! \brief Level of the signal, as given to \ref level() */
+	float signalLevel() const { return signal; }
+	/*! \brief Level of the noise, as given to \ref level() */
+	float noiseLevel() const { return noise; }
+	qint64 ms() const;
+	float signalAt(qint64 ms) const;
+	float noiseAt(qint64 ms) const;
+	void dropLevels(qint64 ms);
+
+	static const int slotMs = 250;  //!< \brief Length of one slot of the level history
+
+private:
+	Q_DISABLE_COPY(DecodeLevel)
+	void keyed(bool on);
+	void stamp();
+	int slotAt(qint64 ms) const;
+
+	float blockMs;   //!< \brief Length of a block, see \ref setBlockMs()
+	qint64 blocks;   //!< \brief Blocks since \ref clear()
+	float signal;    //!< \brief Level of the tone, falls slowly
+	float noise;     //!< \brief Level of the noise, rises slowly
+	bool down;       //!< \brief Key is down
+	int run;         //!< \brief Blocks since the key went up or down
+	int lastGap;     //!< \brief Blocks of the gap before the current tone
+	int lastTone;    //!< \brief Blocks of the tone before, 0 at the start
+	float dit;       //!< \brief Estimated length of a dit, in blocks
+	bool charDone;   //!< \brief The current gap already ended a character
+	bool wordDone;   //!< \brief The current gap already ended a word
+	qint64 charStart;        //!< \brief Block where the current character started
+	QVector<qint64> starts;  //!< \brief Start block of each character in \ref text()
+	QVector<float> slotSignal;  //!< \brief History of \ref signal, see \ref signalAt()
+	QVector<float> slotNoise;   //!< \brief History of \ref noise, see \ref noiseAt()
+	qint64 firstSlot;           //!< \brief Slot of the first entry of the history
+
+	DecodeMorse morse;  //!< \brief Turns dits and dahs into text
+	DecodeViterbi *viterbi; //!< \brief Used instead of \ref morse, see \ref setViterbi()
+};
+
+
+/*!
+ * \brief Decodes morse from audio samples into clear text
+ *
+ * The samples are cut into short blocks. For each block a tone detector
+ * measures how loud the tone at the CW pitch is, and \ref DecodeLevel
+ * makes text out of that.
+ *
+ * Usage:
+ * \code
+ *   DecodeAudio dec(700);
+ *   dec.decodeFile("cq.wav");
+ *   printf("%s\n", qPrintable(dec.text()));
+ * \endcode
+ *
+ * For live audio call \ref decode() whenever the device has new samples,
+ * and take the text with \ref takeText().
+ *
+ * A decoder needs a few kB and no thread of it's own, so one core can run
+ * many of them, e.g. one per channel of a receiver.
+ */
+class DecodeAudio : public DecodeLevel {
+public:
+	DecodeAudio(int freq=800, int sampleRate=SAMPLE_RATE);
+	void setFreq(int freq);
+	void setFormat(int sampleRate, int chans=1);
+
+	void process(const float *samples, int n);
+	void process(const qint16 *frames, int n);
+	qint64 decode(QIODevice *in);
+	bool decodeFile(const QString &fname);
+	qint64 frames() const;
+	/*! \brief Samples per second, see \ref setFormat() */
+	int sampleRate() const { return rate; }
+	void clear();
+
+	static bool readWavHeader(QIODevice *in, int *sampleRate, int *chans, qint64 *dataBytes=0);
+	static void toFloat(const qint16 *frames, int n, int chans, float *out);
+private:
+	void makeTables();
+	void detect(const float *block);
+
+	int freq;        //!< \brief Pitch of the tone, see \ref setFreq()
+	int rate;        //!< \brief Sample rate, see \ref setFormat()
+	int channels;    //!< \brief Channels of 16 bit frames, they get mixed to mono
+	int blockLen;    //!< \brief Samples per detector block
+	QVector<float> cosTab;  //!< \brief Window times cosine at \ref freq
+	QVector<float> sinTab;  //!< \brief Window times sine at \ref freq
+	QVector<float> pending; //!< \brief Start of a block that isn't complete yet
+	int fill;        //!< \brief Samples in \ref pending
+	QByteArray carry;   //!< \brief Part of a frame left over by \ref decode()
+	qint64 dataLeft;    //!< \brief Bytes of the WAV samples still to come, -1 for no limit
+	qint64 frameCount;  //!< \brief See \ref frames()
+};
+
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Decodes many morse recordings into transcripts, on all cores.
+ *
+ * Usage: decode_batch [-j threads] [-p pitch] [-r rate] [-b beam] [-o dir] dir|file...
+ *
+ * Directories are searched for *.wav, *.raw and *.pcm files. WAV files
+ * must be 16 bit PCM, other files are raw 16 bit mono samples at the
+ * rate of -r. With -b, the decoder is a DecodeViterbi with that beam.
+ * Characters come from the character table that is compiled in.
+ *
+ * Each recording gets a transcript with the same name and ".txt", next
+ * to it or in the directory of -o. It has one line per word, with the
+ * start of the word in ms, the word, and the start of each character:
+ *
+ *   1520	cq	1520,1890
+ */
+
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QtEndian>
+
+#include "decode_audio.h"
+#include "sinesource.h"
+#include "work_pool.h"
+
+#include <stdio.h>
+
+
+/*!
+ * \brief Frames that get decoded in one go
+ */
+#define CHUNK_FRAMES 65536
+
+
+/*!
+ * \brief Settings from the command line
+ */
+struct DecodeOptions {
+	int pitch;
+	int rate;      //!< \brief Sample rate of raw files
+	int beam;      //!< \brief Use DecodeViterbi if not 0
+	QString outDir;
+
+	DecodeOptions() : pitch(800), rate(SAMPLE_RATE), beam(0) {}
+};
+
+
+/*!
+ * \brief Decodes the recordings, called by the \ref WorkPool workers
+ *
+ * Every worker has it's own DecodeAudio, which gets cleared from job to
+ * job. The recordings are mapped into memory and decoded right from
+ * there, without copying them through a read buffer.
+ */
+class DecodeTask : public WorkPool::Task {
+public:
+	DecodeTask(const QStringList &f, const DecodeOptions &o, int threads);
+	~DecodeTask();
+	void runJob(int job, int worker);
+
+	double seconds() const;
+	int failed() const;
+private:
+	struct Worker {
+		DecodeAudio *dec;
+		double seconds;   //!< \brief Audio decoded so far
+		int failed;
+	};
+	bool decode(DecodeAudio *dec, QFile &file);
+	bool writeTranscript(DecodeAudio *dec, const QString &fname);
+
+	const QStringList &files;
+	const DecodeOptions &opts;
+	QVector<Worker> workers;
+};
+
+
+DecodeTask::DecodeTask(const QStringList &f, const DecodeOptions &o, int threads)
+	: files(f)
+	, opts(o)
+{
+	Worker w;
+	w.dec = 0;
+	w.seconds = 0;
+	w.failed = 0;
+	workers.fill(w, threads);
+}
+
+
+DecodeTask::~DecodeTask()
+{
+	for (int i = 0; i < workers.size(); i++)
+		delete workers[i].dec;
+}
+
+
+/*!
+ * \brief Decode all of \a file with \a dec
+ *
+ * Files that can't be mapped, e.g. on some network file systems, are
+ * read the normal way.
+ */
+bool DecodeTask::decode(DecodeAudio *dec, QFile &file)
+{
+	qint64 size = file.size();
+	uchar *map = size ? file.map(0, size) : 0;
+	if (!map)
+		return dec->decode(&file) >= 0;
+
+	// Only the header gets read through a QBuffer, there's no copy
+	QByteArray raw = QByteArray::fromRawData((const char *)map, size);
+	QBuffer head(&raw);
+	head.open(QIODevice::ReadOnly);
+	int rate = opts.rate;
+	int chans = 1;
+	qint64 bytes = -1;
+	if (raw.startsWith("RIFF") && !DecodeAudio::readWavHeader(&head, &rate, &chans, &bytes)) {
+		file.unmap(map);
+		return false;
+	}
+	dec->setFormat(rate, chans);
+
+	// Chunks after the samples (LIST, id3) aren't audio
+	qint64 left = size - head.pos();
+	if (bytes >= 0)
+		left = qMin(left, bytes);
+
+	// WAV chunks have an even size, so the samples are aligned
+	const qint16 *frames = (const qint16 *)(map + head.pos());
+	qint64 n = left / (2 * chans);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+	QVector<qint16> swapped(CHUNK_FRAMES * chans);
+#endif
+	while (n > 0) {
+		int len = qMin(n, (qint64)CHUNK_FRAMES);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+		for (int i = 0; i < len * chans; i++)
+			swapped[i] = qFromLittleEndian(frames[i]);
+		dec->process(swapped.constData(), len);
+#else
+		dec->process(frames, len);
+#endif
+		frames += len * chans;
+		n -= len;
+	}
+	file.unmap(map);
+	return true;
+}
+
+
+/*!
+ * \brief Write the text of \a dec as the transcript of \a fname
+ */
+bool DecodeTask::writeTranscript(DecodeAudio *dec, const QString &fname)
+{
+	QFileInfo info(fname);
+	QDir dir(opts.outDir.isEmpty() ? info.path() : opts.outDir);
+	QFile out(dir.filePath(info.completeBaseName() + ".txt"));
+	if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qWarning("can't write %s", qPrintable(out.fileName()));
+		return false;
+	}
+
+	const QString &text = dec->text();
+	QByteArray lines;
+	int i = 0;
+	while (i < text.size()) {
+		if (text.at(i) == ' ') {
+			i++;
+			continue;
+		}
+		int end = text.indexOf(' ', i);
+		if (end < 0)
+			end = text.size();
+		QByteArray stamps;
+		for (int c = i; c < end; c++) {
+			if (c > i)
+				stamps += ',';
+			stamps += QByteArray::number(dec->charMs(c));
+		}
+		lines += QByteArray::number(dec->charMs(i)) + '\t' +
+		         text.mid(i, end - i).toUtf8() + '\t' + stamps + '\n';
+		i = end;
+	}
+	return out.write(lines) == lines.size();
+}
+
+
+void DecodeTask::runJob(int n, int worker)
+{
+	Worker &w = workers[worker];
+	if (!w.dec) {
+		w.dec = new DecodeAudio(opts.pitch);
+		if (opts.beam)
+			w.dec->setViterbi(opts.beam);
+	}
+
+	const QString &fname = files.at(n);
+	DecodeAudio *dec = w.dec;
+	// Every recording starts without what the last one taught
+	dec->clear();
+	dec->setWpm(20);
+	dec->setFormat(opts.rate, 1);
+
+	QFile file(fname);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qWarning("can't read %s", qPrintable(fname));
+		w.failed++;
+		return;
+	}
+	if (!decode(dec, file)) {
+		qWarning("%s: unsupported WAV format", qPrintable(fname));
+		w.failed++;
+		return;
+	}
+	dec->flush();
+
+	if (!writeTranscript(dec, fname)) {
+		w.failed++;
+		return;
+	}
+	w.seconds += (double)dec->frames() / dec->sampleRate();
+}
+
+
+/*!
+ * \brief Seconds of audio in all recordings that got decoded
+ */
+double DecodeTask::seconds() const
+{
+	double s = 0;
+	foreach(const Worker &w, workers)
+		s += w.seconds;
+	return s;
+}
+
+
+int DecodeTask::failed() const
+{
+	int n = 0;
+	foreach(const Worker &w, workers)
+		n += w.failed;
+	return n;
+}
+
+
+/*!
+ * \brief The recordings in \a args, with directories searched
+ */
+static QStringList findFiles(const QStringList &args)
+{
+	QStringList filters;
+	filters << "*.wav" << "*.raw" << "*.pcm";
+
+	QStringList files;
+	foreach(const QString &arg, args) {
+		if (!QFileInfo(arg).isDir()) {
+			files.append(arg);
+			continue;
+		}
+		QDir dir(arg);
+		foreach(const QString &name, dir.entryList(filters, QDir::Files, QDir::Name))
+			files.append(dir.filePath(name));
+	}
+	return files;
+}
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QStringList args = app.arguments();
+	args.removeFirst();
+	int threads = 0;
+	DecodeOptions opts;
+	while (args.size() >= 2 && args.at(0).startsWith("-")) {
+		QString opt = args.takeFirst();
+		QString value = args.takeFirst();
+		if (opt == "-j")
+			threads = value.toInt();
+		else if (opt == "-p")
+			opts.pitch = value.toInt();
+		else if (opt == "-r")
+			opts.rate = value.toInt();
+		else if (opt == "-b")
+			opts.beam = value.toInt();
+		else if (opt == "-o")
+			opts.outDir = value;
+		else {
+			args.clear();
+			break;
+		}
+	}
+	if (args.isEmpty() || opts.rate <= 0) {
+		fprintf(stderr, "Usage: decode_batch [-j threads] [-p pitch] [-r rate] [-b beam] [-o dir] dir|file...\n");
+		return 1;
+	}
+	QStringList files = findFiles(args);
+
+	WorkPool pool(threads);
+	DecodeTask task(files, opts, pool.threads());
+
+	QElapsedTimer timer;
+	timer.start();
+	pool.run(files.size(), &task);
+	qint64 ms = qMax(timer.elapsed(), (qint64)1);
+
+	double hours = task.seconds() / 3600;
+	printf("%d files, %d failed, %.1f hours of audio in %.2f s\n",
+	       files.size(), task.failed(), hours, ms / 1e3);
+	printf("%.2f audio hours per minute, %.0fx realtime, %d threads\n",
+	       hours * 60000 / ms, hours * 3600e3 / ms, pool.threads());
+
+	return task.failed() ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Decodes the timing of a human sender, given as key down and key up
+ * times, into clear text.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <math.h>
+#include "decode_keying.h"
+
+
+/*!
+ * \brief Tones and gaps shorter than this are contact bounce
+ *
+ * A short tone is ignored, a short gap joins the tones before and after.
+ */
+#define DEBOUNCE_MS 8
+
+
+/*!
+ * \brief Part by which a learned length moves towards a new one
+ *
+ * Higher follows a changing speed faster, lower is less confused by a
+ * sloppy fist.
+ */
+#define GAIN 0.15f
+
+
+/*!
+ * \brief Dahs are at least this much longer than dits
+ *
+ * The same goes for the gap between characters and the one inside of a
+ * character. It keeps the two lengths apart when a sender only sends
+ * dits for a while, e.g. "5 s h".
+ */
+#define MIN_RATIO 2.0f
+
+
+/*!
+ * \brief Gaps this many character gaps long end a word
+ *
+ * The book says 7/3, the middle between that and 1 is 5/3.
+ */
+#define WORD_GAP (5.0f / 3)
+
+
+/*!
+ * \brief Learn one more length \a len
+ */
+void DecodeKeying::Cluster::add(float len)
+{
+	if (n < 1000)
+		n++;
+	ms += (len - ms) * qMax(1.0f / n, GAIN);
+}
+
+
+/*!
+ * \brief Creates a decoder that expects \a wpm at first
+ */
+DecodeKeying::DecodeKeying(float wpm)
+{
+	MYTRACE("DecodeKeying::DecodeKeying");
+	setWpm(wpm);
+	clear();
+}
+
+
+/*!
+ * \brief Set the speed to start with
+ *
+ * The decoder follows the speed of the sender by itself, this only
+ * makes the first characters come out right. It forgets what it learned
+ * about the sender.
+ */
+void DecodeKeying::setWpm(float wpm)
+{
+	// PARIS is 50 dits long
+	float unit = 60000.0f / 50 / wpm;
+	dit.set(unit);
+	dah.set(3 * unit);
+	intra.set(unit);
+	chr.set(3 * unit);
+}
+
+
+/*!
+ * \brief Returns the speed that the decoder currently hears
+ *
+ * This is the speed of the tones. Many senders have longer gaps, so
+ * they send less characters per minute than this.
+ */
+float DecodeKeying::wpm() const
+{
+	return 60000.0f / 50 / ((dit.ms + dah.ms / 3) / 2);
+}
+
+
+/*!
+ * \brief Forget the text and the current character
+ *
+ * The learned lengths stay.
+ */
+void DecodeKeying::clear()
+{
+	down = false;
+	started = false;
+	edge = 0;
+	gapStart = 0;
+	pending = 0;
+	lastTone = 0;
+	charDone = true;
+	wordDone = true;
+	morse.clear();
+}
+
+
+/*!
+ * \brief Learned gap between characters
+ *
+ * It's never shorter than a dah, even when a lot of gaps between
+ * characters looked like gaps between words. Senders often stretch
+ * these gaps, but hardly ever squeeze them. And the tones tell the speed
+ * much earlier.
+ */
+float DecodeKeying::chrMs() const
+{
+	return qMax(chr.ms, dah.ms);
+}
+
+
+/*!
+ * \brief Gaps longer than this end a character
+ *
+ * That's in the middle between the two gaps, in the sense that both are
+ * the same factor away from it.
+ */
+float DecodeKeying::charGap() const
+{
+	return sqrtf(intra.ms * chrMs());
+}
+
+
+/*!
+ * \brief Gaps longer than this end a word
+ */
+float DecodeKeying::wordGap() const
+{
+	return chrMs() * WORD_GAP;
+}
+
+
+/*!
+ * \brief The key went down at \a ms
+ *
+ * This ends the gap before. Calls for a key that is already down are
+ * ignored.
+ */
+void DecodeKeying::keyDown(qint64 ms)
+{
+	if (down)
+		return;
+	down = true;
+
+	float len = ms - edge;
+	if (pending && len < DEBOUNCE_MS) {
+		// Bounce, the tone before simply goes on
+		edge -= (qint64)pending;
+		pending = 0;
+		return;
+	}
+	if (pending) {
+		tone(pending);
+		pending = 0;
+	}
+	if (started)
+		gap(len, true);
+	started = true;
+	charDone = false;
+	wordDone = false;
+	gapStart = edge;
+	edge = ms;
+}
+
+
+/*!
+ * \brief The key went up at \a ms
+ *
+ * The tone isn't decoded yet, the key could just bounce. That happens at
+ * the next \ref keyDown(), or with \ref idle().
+ */
+void DecodeKeying::keyUp(qint64 ms)
+{
+	if (!down)
+		return;
+	down = false;
+
+	float len = ms - edge;
+	if (len < DEBOUNCE_MS) {
+		// A click, the gap before simply goes on
+		edge = gapStart;
+		return;
+	}
+	pending = len;
+	edge = ms;
+}
+
+
+/*!
+ * \brief Nothing happened until \a ms
+ *
+ * A gap ends the character or the word as soon as it's long enough.
+ * Call this now and then, e.g. from a timer, so that the last character
+ * comes out without waiting for the next one.
+ */
+void DecodeKeying::idle(qint64 ms)
+{
+	if (down || !started)
+		return;
+	float len = ms - edge;
+	if (pending) {
+		if (len < DEBOUNCE_MS)
+			return;
+		tone(pending);
+		pending = 0;
+	}
+	gap(len, false);
+}
+
+
+/*!
+ * \brief The stream ended, finish the current character
+ *
+ * A tone that is still keyed has no length and is lost.
+ */
+void DecodeKeying::flush()
+{
+	if (pending) {
+		tone(pending);
+		pending = 0;
+	}
+	morse.endChar();
+	charDone = true;
+	down = false;
+}
+
+
+/*!
+ * \brief Decode a tone of \a len ms
+ *
+ * It's a dit when it's nearer to the learned dit than to the learned dah,
+ * measured as a factor, otherwise a dah.
+ *
+ * Learning alone can get stuck when the speed changes a lot, e.g. when
+ * the dahs of a faster sender are still nearer to the old dit. So when
+ * one of two tones in a row is much longer than the other, but both got
+ * the same class, they must be a dit and a dah. Then the decoder starts
+ * learning from them anew, and scales the gaps by the same factor.
+ */
+void DecodeKeying::tone(float len)
+{
+	float split = sqrtf(dit.ms * dah.ms);
+	if (lastTone) {
+		float lo = qMin(len, lastTone);
+		float hi = qMax(len, lastTone);
+		if (hi > MIN_RATIO * lo && (hi < split || lo > split)) {
+			MYVERBOSE("resync, dit %.0f -> %.0f ms", dit.ms, lo);
+			float f = lo / dit.ms;
+			intra.set(intra.ms * f);
+			chr.set(chr.ms * f);
+			dit.set(lo);
+			dah.set(hi);
+			split = sqrtf(lo * hi);
+		}
+	}
+	lastTone = len;
+
+	if (len < split) {
+		morse.dit();
+		dit.add(len);
+		dah.ms = qMax(dah.ms, dit.ms * MIN_RATIO);
+	} else {
+		morse.dah();
+		dah.add(len);
+		dit.ms = qMin(dit.ms, dah.ms / MIN_RATIO);
+	}
+}
+
+
+/*!
+ * \brief Decode a gap of \a len ms
+ *
+ * With \a done the gap is over and it's length is learned, otherwise it
+ * may still grow. Gaps between words teach the gap between characters as
+ * well, otherwise a sender with long gaps would only send words of one
+ * character.
+ */
+void DecodeKeying::gap(float len, bool done)
+{
+	if (!charDone && len > charGap()) {
+		morse.endChar();
+		charDone = true;
+	}
+	if (!wordDone && len > wordGap()) {
+		morse.endWord();
+		wordDone = true;
+	}
+	if (!done)
+		return;
+
+	if (wordDone) {
+		// The book says 7/3 character gaps. Longer pauses say nothing
+		// about the speed.
+		if (len < 2 * wordGap())
+			chr.add(len * 3 / 7);
+		intra.ms = qMin(intra.ms, chr.ms / MIN_RATIO);
+	} else if (charDone) {
+		chr.add(len);
+		intra.ms = qMin(intra.ms, chr.ms / MIN_RATIO);
+	} else {
+		intra.add(len);
+		chr.ms = qMax(chr.ms, intra.ms * MIN_RATIO);
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef DECODE_KEYING_H
+#define DECODE_KEYING_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QString>
+
+#include "decode_morse.h"
+
+
+/*!
+ * \brief Decodes the key presses of a human sender into clear text
+ *
+ * The decoder only get's the times when the key went down and up, e.g.
+ * from a straight key or a paddle on a web page. Humans don't send the
+ * exact 1:3 and 1:3:7 ratios of \ref GenerateMorse. Their speed drifts,
+ * their dahs are often longer and their gaps between characters and
+ * words often much longer than the book says.
+ *
+ * So the decoder learns four lengths on it's own: dit, dah, the gap
+ * inside of a character and the gap between characters. Each tone or gap
+ * belongs to the nearer of two of them and moves it a bit towards what
+ * it heard. A decoder is a few dozen bytes plus the text that wasn't
+ * taken yet, so a server can run one per connected keyer.
+ *
+ * Usage:
+ * \code
+ *   DecodeKeying dec;
+ *   dec.keyDown(1000);
+ *   dec.keyUp(1060);
+ *   ...
+ *   dec.idle(now);                 // from a timer, ends the last character
+ *   send(dec.takeText());
+ * \endcode
+ *
+ * Times are in milliseconds since any start, they only have to grow.
+ */
+class DecodeKeying {
+public:
+	DecodeKeying(float wpm=20);
+	void setWpm(float wpm);
+	float wpm() const;
+
+	void keyDown(qint64 ms);
+	void keyUp(qint64 ms);
+	void idle(qint64 ms);
+	void flush();
+
+	void clear();
+	const QString &text() const { return morse.text(); } //!< What's decoded so far
+	/*! \brief Return the decoded text and start over */
+	QString takeText() { return morse.takeText(); }
+	/*! \brief Returns true while the key is down */
+	bool isDown() const { return down; }
+
+private:
+	/*!
+	 * \brief One length the sender uses, e.g. the length of a dit
+	 *
+	 * Follows the lengths that were classified as this one. The first ones
+	 * are simply averaged, later ones move it by a fixed part, so that it
+	 * still follows a sender who speeds up. That's what a Kalman filter
+	 * with constant noises settles to.
+	 */
+	struct Cluster {
+		float ms;  //!< \brief Current estimate
+		int n;     //!< \brief Lengths heard so far, plus one for the start value
+		void set(float len) { ms = len; n = 1; }
+		void add(float len);
+	};
+
+	void tone(float len);
+	void gap(float len, bool done);
+	float chrMs() const;
+	float charGap() const;
+	float wordGap() const;
+
+	Cluster dit;     //!< \brief Length of a dit
+	Cluster dah;     //!< \brief Length of a dah
+	Cluster intra;   //!< \brief Gap between the elements of a character
+	Cluster chr;     //!< \brief Gap between two characters
+	bool down;       //!< \brief The key is down
+	bool started;    //!< \brief There was a tone since \ref clear()
+	qint64 edge;     //!< \brief When the key last went up or down
+	qint64 gapStart; //!< \brief When the gap before the current tone started
+	float pending;   //!< \brief Tone that may still go on after a bounce, 0 if none
+	float lastTone;  //!< \brief Length of the tone before, 0 at the start
+	bool charDone;   //!< \brief The current gap already ended a character
+	bool wordDone;   //!< \brief The current gap already ended a word
+
+	DecodeMorse morse;  //!< \brief Turns dits and dahs into text
+};
+
+
+#endif
@@ -0,0 +1,213 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ *
+ * @section DESCRIPTION
+ *
+ * Translates morse code (as text or as elements) back into clear text.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include "decode_morse.h"
+#include "morse.h"
+
+
+DecodeMorse::DecodeMorse()
+	: node(1)
+	, inWord(false)
+{
+	MYTRACE("DecodeMorse::DecodeMorse");
+}
+
+
+/*!
+ * \brief Add a dit to the current character
+ */
+void DecodeMorse::dit()
+{
+	if (node) {
+		node = 2 * node;
+		if (node >= Morse::treeSize)
+			node = 0;
+	}
+}
+
+
+/*!
+ * \brief Add a dah to the current character
+ */
+void DecodeMorse::dah()
+{
+	if (node) {
+		node = 2 * node + 1;
+		if (node >= Morse::treeSize)
+			node = 0;
+	}
+}
+
+
+/*!
+ * \brief Add one element like in \ref GenerateMorse::morse
+ *
+ * 1 is a dit, 3 a dah, -3 ends the character and -7 the word. Other
+ * values (e.g. the gap -1 between elements) are ignored.
+ */
+void DecodeMorse::element(int len)
+{
+	switch (len) {
+	case 1:
+		dit();
+		break;
+	case 3:
+		dah();
+		break;
+	case -3:
+		endChar();
+		break;
+	case -7:
+		endWord();
+		break;
+	}
+}
+
+
+/*!
+ * \brief Finish the current character and append it to \ref text()
+ *
+ * Does nothing when no dit or dah came in since the last character.
+ */
+void DecodeMorse::endChar()
+{
+	if (node == 1)
+		return;
+
+	int token = node ? Morse::treeToken(node) : -1;
+	if (token >= 0)
+		out.append(Morse::tokenSign(token));
+	else
+		out.append(QChar(unknownSign));
+	node = 1;
+	inWord = true;
+}
+
+
+/*!
+ * \brief Finish the current character and the word
+ *
+ * Several word gaps in a row give only one space. The space also comes
+ * when the word was already taken with \ref takeText().
+ */
+void DecodeMorse::endWord()
+{
+	endChar();
+	if (inWord)
+		out.append(' ');
+	inWord = false;
+}
+
+
+void DecodeMorse::clear()
+{
+	node = 1;
+	inWord = false;
+	out.clear();
+}
+
+
+/*!
+ * \brief Return the decoded text and start over
+ *
+ * A character that isn't finished yet stays.
+ */
+QString DecodeMorse::takeText()
+{
+	QString s = out;
+	out.clear();
+	return s;
+}
+
+
+/*!
+ * \brief Worker for the text variants of \ref decode()
+ *
+ * '.' and '-' are the elements, one space ends a character, more spaces,
+ * a newline or a '/' end the word. Everything else is ignored.
+ */
+template<typename C>
+void DecodeMorse::decodeText(const C *code, int len)
+{
+	int spaces = 0;
+	for (int i = 0; i < len; i++) {
+		char c = QChar(code[i]).toAscii();
+		if (c == ' ') {
+			if (++spaces == 1)
+				endChar();
+			else
+				endWord();
+			continue;
+		}
+		spaces = 0;
+		switch (c) {
+		case '.':
+			dit();
+			break;
+		case '-':
+			dah();
+			break;
+		case '/':
+		case '\n':
+			endWord();
+			break;
+		}
+	}
+	endChar();
+}
+
+
+/*!
+ * \brief Decode something like "-.-. --.-  -.. ." into "cq de"
+ */
+QString DecodeMorse::decode(const QString &code)
+{
+	DecodeMorse d;
+	d.decodeText(code.constData(), code.size());
+	return d.out.trimmed();
+}
+
+
+/*!
+ * \brief Same, but for Latin-1 input, e.g. from a file
+ */
+QString DecodeMorse::decode(const QByteArray &code)
+{
+	DecodeMorse d;
+	d.decodeText((const uchar *)code.constData(), code.size());
+	return d.out.trimmed();
+}
+
+
+/*!
+ * \brief Decode elements like in \ref GenerateMorse::morse
+ */
+QString DecodeMorse::decode(const QList<int> &elements)
+{
+	DecodeMorse d;
+	foreach(int e, elements)
+		d.element(e);
+	d.endChar();
+	return d.out.trimmed();
+}
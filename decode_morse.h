@@ -0,0 +1,72 @@
+#ifndef DECODE_MORSE_H
+#define DECODE_MORSE_H
+
+/**
+ * @file
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+
+/*!
+ * \brief Translates morse code back into clear text
+ *
+ * Elements can be fed one by one with \ref dit(), \ref dah(), \ref
+ * endChar() and \ref endWord(), e.g. by something that listens to audio.
+ * Whole texts like "-.-. --.-" or element lists from \ref
+ * GenerateMorse::elements() can be decoded with \ref decode().
+ *
+ * Each element is just one step in the decoding tree of \ref
+ * Morse::treeToken(), so decoding doesn't need any lookup.
+ */
+class DecodeMorse {
+public:
+	DecodeMorse();
+
+	void dit();
+	void dah();
+	void element(int len);
+	void endChar();
+	void endWord();
+
+	void clear();
+	const QString &text() const { return out; } //!< What's decoded so far
+	QString takeText();
+
+	static QString decode(const QString &code);
+	static QString decode(const QByteArray &code);
+	static QString decode(const QList<int> &elements);
+
+	/*! \brief Output for codes that aren't in the character table */
+	static const char unknownSign = '#';
+private:
+	template<typename C> void decodeText(const C *code, int len);
+
+	/*!
+	 * \brief Current node in the decoding tree
+	 *
+	 * 1 is the root, 0 means that the code got too long.
+	 */
+	int node;
+	bool inWord;  //!< A character came since the last space
+	QString out;  //!< Decoded clear text
+};
+
+
+#endif
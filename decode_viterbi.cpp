@@ -0,0 +1,737 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Finds the most likely text for a row of tone and gap lengths, with a
+ * beam search over the morse decoding tree.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QBitArray>
+#include <QHash>
+#include <QtAlgorithms>
+#include <math.h>
+#include "decode_viterbi.h"
+#include "decode_morse.h"
+#include "morse.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef M_LN2
+#define M_LN2 0.69314718055994530942
+#endif
+#ifndef M_SQRT1_2
+#define M_SQRT1_2 0.70710678118654752440
+#endif
+
+
+/*!
+ * \brief Spread of the tone lengths, as the sigma of their logarithm
+ *
+ * 0.2 means that a dit of 1.2 dits is still quite normal. The decoder
+ * in front learns the speed from the tones, so they spread less than
+ * the gaps.
+ */
+#define TONE_SIGMA 0.2f
+
+
+/*!
+ * \brief Spread of the gap lengths, like \ref TONE_SIGMA
+ *
+ * Gaps spread more than tones, the threshold in front of the decoder
+ * makes tones longer and gaps shorter when the signal gets weaker.
+ */
+#define GAP_SIGMA 0.45f
+
+
+/*!
+ * \brief Typical length of a drop out, in dits
+ */
+#define DROP_DITS 0.4f
+
+
+/*!
+ * \brief Spread of the drop outs, like \ref TONE_SIGMA
+ */
+#define DROP_SIGMA 0.6f
+
+
+/*!
+ * \brief Log probability that a gap is a drop out and not a real gap
+ *
+ * Noise breaks tones apart much more often than it makes tones of it's
+ * own, so drop outs are quite likely.
+ */
+#define DROP_LOGP -2.0f
+
+
+/*!
+ * \brief Typical length of a tone that the noise made, in dits
+ */
+#define NOISE_DITS 0.3f
+
+
+/*!
+ * \brief Spread of the noise tones, like \ref TONE_SIGMA
+ */
+#define NOISE_SIGMA 0.7f
+
+
+/*!
+ * \brief Log probability that a tone was only noise
+ *
+ * The clicks are already gone when the lengths get here, a tone that is
+ * left is hardly ever noise.
+ */
+#define NOISE_LOGP -8.0f
+
+
+/*!
+ * \brief Readings this much less likely than the best one are dropped
+ *
+ * In natural log units, so 15 means three million times less likely.
+ */
+#define BEAM_LOGP 15.0f
+
+
+/*!
+ * \brief Most characters that may wait for the readings to agree
+ *
+ * After that the best reading wins. It bounds the delay of the text and
+ * the memory.
+ */
+#define MAX_LAG 8
+
+
+/*!
+ * \brief Lower limit of a log probability
+ */
+#define MIN_LOGP -50.0f
+
+
+/*!
+ * \brief What the decoder needs to know about the decoding tree
+ *
+ * It's the same for all decoders, and gets built by the first one that
+ * is created, in whatever thread that happens.
+ */
+struct ViterbiTables {
+	ViterbiTables();
+
+	/*!
+	 * \brief Index of each node of the decoding tree that has a character
+	 *
+	 * 1 for the first one, 0 for nodes without one. 0 is also the index
+	 * of the space in the bigrams.
+	 */
+	QVector<int> nodeIndex;
+
+	/*!
+	 * \brief Number of characters in the decoding tree plus one for the space
+	 */
+	int indexCount;
+
+	/*!
+	 * \brief True for the nodes that have a character, or one below them
+	 *
+	 * Readings on other nodes can't become a character anymore.
+	 */
+	QBitArray alive;
+};
+
+
+ViterbiTables::ViterbiTables()
+{
+	nodeIndex.fill(0, Morse::treeSize);
+	alive.fill(false, Morse::treeSize);
+	int n = 1;
+	for (int node = 1; node < Morse::treeSize; node++)
+		if (Morse::treeToken(node) >= 0)
+			nodeIndex[node] = n++;
+	for (int node = Morse::treeSize - 1; node >= 1; node--) {
+		bool live = nodeIndex.at(node) != 0;
+		if (2 * node + 1 < Morse::treeSize)
+			live = live || alive.testBit(2 * node) || alive.testBit(2 * node + 1);
+		alive.setBit(node, live);
+	}
+	indexCount = n;
+}
+
+Q_GLOBAL_STATIC(ViterbiTables, tables)
+
+
+/*!
+ * \brief Log probability of log length \a lx, when \a mu is expected
+ *
+ * The lengths are log-normal, so this is a normal distribution of the
+ * logarithm. The constant part is left out, it's the same for all
+ * readings. With \a open the length is only known to be at least that
+ * long, e.g. for a gap that still goes on.
+ */
+static float logNormal(float lx, float mu, float sigma, bool open)
+{
+	float z = (lx - mu) / sigma;
+	float lp;
+	if (open)
+		lp = logf(0.5f * erfcf(z * (float)M_SQRT1_2));
+	else
+		lp = -0.5f * z * z - logf(sigma);
+	return qMax(lp, MIN_LOGP);
+}
+
+
+#if defined(__SSE2__)
+/*!
+ * \brief Natural logarithm of four positive floats
+ *
+ * The exponent comes straight out of the bits, the mantissa goes through
+ * a polynomial. It's about 1e-4 off, much less than the spread of the
+ * lengths.
+ */
+static inline __m128 logPs(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff))),
+	                     _mm_set1_ps(1.0f));
+	// log2() of the mantissa in [1, 2)
+	__m128 p = _mm_set1_ps(-0.056570851f);
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(0.44717955f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.4699568f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(2.8212026f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.7417939f));
+	return _mm_mul_ps(_mm_add_ps(p, e), _mm_set1_ps((float)M_LN2));
+}
+
+
+/*!
+ * \brief Log probabilities of the log lengths \a lx, when \a mu is expected
+ *
+ * Same as \ref logNormal(), for four lengths at once.
+ */
+static inline __m128 logNormalPs(__m128 lx, float mu, float sigma)
+{
+	__m128 z = _mm_mul_ps(_mm_sub_ps(lx, _mm_set1_ps(mu)), _mm_set1_ps(1 / sigma));
+	__m128 lp = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(z, z), _mm_set1_ps(-0.5f)),
+	                       _mm_set1_ps(logf(sigma)));
+	return _mm_max_ps(lp, _mm_set1_ps(MIN_LOGP));
+}
+#endif
+
+
+/*!
+ * \brief Log probabilities that tones are a dit or a dah
+ *
+ * @param len  length of each of the \a n tones in dits
+ * @param dit  gets the log probabilities for a dit
+ * @param dah  gets the log probabilities for a dah
+ */
+void DecodeViterbi::toneLogProbs(const float *len, int n, float *dit, float *dah)
+{
+	const float ln3 = logf(3);
+	int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4) {
+		__m128 lx = logPs(_mm_loadu_ps(len + i));
+		_mm_storeu_ps(dit + i, logNormalPs(lx, 0, TONE_SIGMA));
+		_mm_storeu_ps(dah + i, logNormalPs(lx, ln3, TONE_SIGMA));
+	}
+#endif
+	for (; i < n; i++) {
+		float lx = logf(len[i]);
+		dit[i] = logNormal(lx, 0, TONE_SIGMA, false);
+		dah[i] = logNormal(lx, ln3, TONE_SIGMA, false);
+	}
+}
+
+
+/*!
+ * \brief Log probabilities of what gaps are
+ *
+ * @param len    length of each of the \a n gaps in dits
+ * @param intra  gets the log probabilities for a gap inside of a character
+ * @param chr    ... for a gap between characters
+ * @param word   ... for a gap between words
+ * @param drop   ... for a drop out inside of a tone
+ */
+void DecodeViterbi::gapLogProbs(const float *len, int n, float *intra, float *chr, float *word, float *drop)
+{
+	const float ln3 = logf(3);
+	const float ln7 = logf(7);
+	const float lnDrop = logf(DROP_DITS);
+	int i = 0;
+#if defined(__SSE2__)
+	__m128 vd = _mm_set1_ps(DROP_LOGP);
+	for (; i + 4 <= n; i += 4) {
+		__m128 lx = logPs(_mm_loadu_ps(len + i));
+		_mm_storeu_ps(intra + i, logNormalPs(lx, 0, GAP_SIGMA));
+		_mm_storeu_ps(chr + i, logNormalPs(lx, ln3, GAP_SIGMA));
+		_mm_storeu_ps(word + i, logNormalPs(lx, ln7, GAP_SIGMA));
+		_mm_storeu_ps(drop + i, _mm_add_ps(vd, logNormalPs(lx, lnDrop, DROP_SIGMA)));
+	}
+#endif
+	for (; i < n; i++) {
+		float lx = logf(len[i]);
+		intra[i] = logNormal(lx, 0, GAP_SIGMA, false);
+		chr[i] = logNormal(lx, ln3, GAP_SIGMA, false);
+		word[i] = logNormal(lx, ln7, GAP_SIGMA, false);
+		drop[i] = DROP_LOGP + logNormal(lx, lnDrop, DROP_SIGMA, false);
+	}
+}
+
+
+/*!
+ * \brief Creates a decoder that keeps up to \a _beam readings
+ */
+DecodeViterbi::DecodeViterbi(int _beam)
+	: beam(qMax(_beam, 1))
+{
+	MYTRACE("DecodeViterbi::DecodeViterbi(%d)", _beam);
+	clear();
+}
+
+
+/*!
+ * \brief Keep up to \a _beam readings
+ *
+ * More readings find the right text more often, but cost time. Each one
+ * costs about the same as a threshold decoder.
+ */
+void DecodeViterbi::setBeam(int _beam)
+{
+	beam = qMax(_beam, 1);
+}
+
+
+/*!
+ * \brief Use bigrams from \ref bigrams(), times \a weight
+ *
+ * An empty vector switches them off, then each character is as likely
+ * as any other. With the full weight, a pair that the text didn't have
+ * beats clear lengths, and clean morse gets decoded wrong.
+ */
+void DecodeViterbi::setBigrams(const QVector<float> &logProbs, float weight)
+{
+	lm.clear();
+	int n = tables()->indexCount;
+	if (logProbs.size() != n * n)
+		return;
+	lm.resize(logProbs.size());
+	for (int i = 0; i < lm.size(); i++)
+		lm[i] = logProbs.at(i) * weight;
+}
+
+
+/*!
+ * \brief Count how often characters follow each other in \a text
+ *
+ * Returns the log probability of each character after each other one,
+ * including the space, for \ref setBigrams(). Pairs that aren't in the
+ * text count as once, so that nothing is impossible.
+ */
+QVector<float> DecodeViterbi::bigrams(const QString &text)
+{
+	const ViterbiTables *t = tables();
+	QHash<ushort, int> index;
+	for (int node = 1; node < Morse::treeSize; node++) {
+		if (!t->nodeIndex.at(node))
+			continue;
+		const QString &sign = Morse::tokenSign(Morse::treeToken(node));
+		if (sign.size() == 1)
+			index.insert(sign.at(0).unicode(), t->nodeIndex.at(node));
+	}
+
+	int n = t->indexCount;
+	QVector<float> counts(n * n, 1.0f);
+	QString lower = text.toLower();
+	int prev = 0;
+	for (int i = 0; i < lower.size(); i++) {
+		QChar c = lower.at(i);
+		int cur;
+		if (c.isSpace())
+			cur = 0;
+		else if (index.contains(c.unicode()))
+			cur = index.value(c.unicode());
+		else
+			continue;
+		if (cur || prev)
+			counts[prev * n + cur] += 1;
+		prev = cur;
+	}
+
+	for (int p = 0; p < n; p++) {
+		float sum = 0;
+		for (int c = 0; c < n; c++)
+			sum += counts.at(p * n + c);
+		for (int c = 0; c < n; c++)
+			counts[p * n + c] = logf(counts.at(p * n + c) / sum);
+	}
+	return counts;
+}
+
+
+
+
+/*!
+ * \brief Start over with one reading at the root of the tree
+ */
+void DecodeViterbi::restart()
+{
+	Hyp h;
+	h.node = 1;
+	h.prev = 0;
+	h.tone = 0;
+	h.gap = 0;
+	h.toneStamp = 0;
+	h.gapStamp = 0;
+	h.charStart = 0;
+	hyps.clear();
+	hyps.append(h);
+	scores.fill(0, 1);
+}
+
+
+/*!
+ * \brief Forget everything
+ */
+void DecodeViterbi::clear()
+{
+	restart();
+	havePending = false;
+	out.clear();
+	starts.clear();
+}
+
+
+/*!
+ * \brief Return the final text and start over
+ *
+ * Readings that don't agree yet stay.
+ */
+QString DecodeViterbi::takeText()
+{
+	QString s = out;
+	out.clear();
+	starts.clear();
+	return s;
+}
+
+
+/*!
+ * \brief A tone of \a dits came, that started at \a stamp
+ *
+ * It's only decoded with the gap after it. Tones and gaps must take
+ * turns.
+ */
+void DecodeViterbi::tone(float dits, qint64 stamp)
+{
+	pendingTone = qMax(dits, 0.01f);
+	pendingStamp = stamp;
+	havePending = true;
+}
+
+
+/*!
+ * \brief Append the character \a token to the reading \a h
+ */
+void DecodeViterbi::appendChar(Hyp &h, int token, qint64 stamp)
+{
+	h.text += Morse::tokenSign(token);
+	while (h.starts.size() < h.text.size())
+		h.starts.append(stamp);
+}
+
+
+/*!
+ * \brief Add a reading \a h with \a score to \ref next
+ */
+void DecodeViterbi::add(const Hyp &h, float score)
+{
+	next.append(h);
+	nextScores.append(score);
+}
+
+
+/*!
+ * \brief Decide what the tone and the gap of \a h were
+ *
+ * Adds a reading to \ref next for each possibility, with nothing
+ * pending. \a gapLp holds the log probabilities of the gap for inside of
+ * a character, between characters and between words. With \a open the
+ * gap still goes on, so the character ends.
+ */
+void DecodeViterbi::classify(const Hyp &h, float score, float ditLp, float dahLp,
+                             const float *gapLp, bool open)
+{
+	const ViterbiTables *t = tables();
+	qint64 cs = h.node == 1 ? h.toneStamp : h.charStart;
+	for (int el = 0; el < 2; el++) {
+		int node = 2 * h.node + el;
+		if (node >= Morse::treeSize || !t->alive.testBit(node))
+			continue;
+		float s = score + (el ? dahLp : ditLp);
+
+		Hyp c = h;
+		c.tone = 0;
+		c.gap = 0;
+		c.charStart = cs;
+		if (!open && 2 * node + 1 < Morse::treeSize &&
+		    (t->alive.testBit(2 * node) || t->alive.testBit(2 * node + 1))) {
+			c.node = node;
+			add(c, s + gapLp[0]);
+		}
+
+		int idx = t->nodeIndex.at(node);
+		if (!idx)
+			continue;
+		float lmChar = lm.isEmpty() ? 0 : lm.at(h.prev * t->indexCount + idx);
+		float lmSpace = lm.isEmpty() ? 0 : lm.at(idx * t->indexCount);
+
+		c.node = 1;
+		c.prev = idx;
+		appendChar(c, Morse::treeToken(node), cs);
+		add(c, s + gapLp[1] + lmChar);
+
+		c.prev = 0;
+		c.text += ' ';
+		c.starts.append(h.gapStamp);
+		add(c, s + gapLp[2] + lmChar + lmSpace);
+	}
+}
+
+
+/*!
+ * \brief Decide what is pending in all readings, the gap is \a open
+ *
+ * Replaces \ref next.
+ */
+void DecodeViterbi::finish()
+{
+	const float ln3 = logf(3);
+	const float ln7 = logf(7);
+	QVector<Hyp> in = next;
+	QVector<float> inScores = nextScores;
+	next.clear();
+	nextScores.clear();
+	for (int i = 0; i < in.size(); i++) {
+		const Hyp &h = in.at(i);
+		if (!h.tone) {
+			add(h, inScores.at(i));
+			continue;
+		}
+		float dit, dah;
+		toneLogProbs(&h.tone, 1, &dit, &dah);
+		float lg = logf(qMax(h.gap, 0.01f));
+		float gapLp[3];
+		gapLp[0] = logNormal(lg, 0, GAP_SIGMA, true);
+		gapLp[1] = logNormal(lg, ln3, GAP_SIGMA, true);
+		gapLp[2] = logNormal(lg, ln7, GAP_SIGMA, true);
+		classify(h, inScores.at(i), dit, dah, gapLp, true);
+	}
+}
+
+
+/*!
+ * \brief Sorts indices by the score they point to, best first
+ */
+struct ScoreOrder {
+	const float *scores;
+	ScoreOrder(const float *s) : scores(s) {}
+	bool operator()(int a, int b) const { return scores[a] > scores[b]; }
+};
+
+
+/*!
+ * \brief A gap of \a dits came after the tone, that started at \a stamp
+ *
+ * Each reading still has the tone and the gap before this one pending,
+ * and branches into what they can be:
+ *
+ * - the new tone was only noise, so the pending gap goes on
+ * - the pending gap was a drop out, so the pending tone goes on
+ * - the pending tone was a dit or a dah, and the pending gap was inside
+ *   of a character, between characters or between words
+ *
+ * In the last two cases the new tone and gap become pending. The best
+ * \ref beam new readings stay, but only the best one of those that would
+ * go on the same way: same node, same last character and same pending
+ * lengths.
+ *
+ * @param dits   length of the gap in dits
+ * @param stamp  where the gap started, becomes the stamp of a space
+ * @param open   the gap is at least this long and still goes on
+ */
+void DecodeViterbi::gap(float dits, qint64 stamp, bool open)
+{
+	if (!havePending)
+		return;
+	havePending = false;
+	dits = qMax(dits, 0.01f);
+
+	int n = hyps.size();
+	toneLens.resize(n);
+	gapLens.resize(n);
+	for (int i = 0; i < n; i++) {
+		toneLens[i] = qMax(hyps.at(i).tone, 0.01f);
+		gapLens[i] = qMax(hyps.at(i).gap, 0.01f);
+	}
+	ditLp.resize(n);
+	dahLp.resize(n);
+	intraLp.resize(n);
+	charLp.resize(n);
+	wordLp.resize(n);
+	dropLp.resize(n);
+	toneLogProbs(toneLens.constData(), n, ditLp.data(), dahLp.data());
+	gapLogProbs(gapLens.constData(), n, intraLp.data(), charLp.data(), wordLp.data(), dropLp.data());
+	float eNoise = NOISE_LOGP + logNormal(logf(pendingTone), logf(NOISE_DITS), NOISE_SIGMA, false);
+
+	next.clear();
+	nextScores.clear();
+	for (int i = 0; i < n; i++) {
+		const Hyp &h = hyps.at(i);
+		float s = scores.at(i);
+
+		Hyp c = h;
+		if (h.tone)
+			c.gap = h.gap + pendingTone + dits;
+		add(c, s + eNoise);
+
+		int first = next.size();
+		if (h.tone) {
+			c = h;
+			c.tone = h.tone + h.gap + pendingTone;
+			c.gap = dits;
+			c.gapStamp = stamp;
+			add(c, s + dropLp.at(i));
+
+			float gapLp[3] = { intraLp.at(i), charLp.at(i), wordLp.at(i) };
+			first = next.size();
+			classify(h, s, ditLp.at(i), dahLp.at(i), gapLp, false);
+		} else {
+			add(h, s);
+		}
+		for (int k = first; k < next.size(); k++) {
+			next[k].tone = pendingTone;
+			next[k].toneStamp = pendingStamp;
+			next[k].gap = dits;
+			next[k].gapStamp = stamp;
+		}
+	}
+	if (open)
+		finish();
+
+	order.resize(next.size());
+	for (int i = 0; i < order.size(); i++)
+		order[i] = i;
+	qSort(order.begin(), order.end(), ScoreOrder(nextScores.constData()));
+
+	float best = nextScores.at(order.first());
+	hyps.clear();
+	scores.clear();
+	for (int k = 0; k < order.size() && hyps.size() < beam; k++) {
+		int i = order.at(k);
+		float s = nextScores.at(i);
+		if (s < best - BEAM_LOGP)
+			break;
+		const Hyp &h = next.at(i);
+		bool same = false;
+		for (int j = 0; j < hyps.size() && !same; j++) {
+			const Hyp &o = hyps.at(j);
+			same = o.node == h.node && o.prev == h.prev && o.tone == h.tone && o.gap == h.gap;
+		}
+		if (same)
+			continue;
+		hyps.append(h);
+		// Keep the numbers small
+		scores.append(s - best);
+	}
+
+	commit();
+}
+
+
+/*!
+ * \brief Move the text that all readings agree on into \ref out
+ *
+ * When the best reading is too far ahead, it wins, and readings that
+ * don't agree with it die.
+ */
+void DecodeViterbi::commit()
+{
+	for (;;) {
+		const QString &first = hyps.first().text;
+		int len = first.size();
+		for (int j = 1; j < hyps.size() && len; j++) {
+			const QString &t = hyps.at(j).text;
+			int k = 0;
+			while (k < len && k < t.size() && t.at(k) == first.at(k))
+				k++;
+			len = k;
+		}
+		if (len) {
+			out += first.left(len);
+			starts += hyps.first().starts.mid(0, len);
+			for (int j = 0; j < hyps.size(); j++) {
+				hyps[j].text.remove(0, len);
+				hyps[j].starts.remove(0, len);
+			}
+		}
+		if (hyps.first().text.size() <= MAX_LAG)
+			return;
+
+		MYVERBOSE("DecodeViterbi: best reading wins");
+		QChar c = hyps.first().text.at(0);
+		for (int j = hyps.size() - 1; j > 0; j--) {
+			if (hyps.at(j).text.isEmpty() || hyps.at(j).text.at(0) != c) {
+				hyps.remove(j);
+				scores.remove(j);
+			}
+		}
+	}
+}
+
+
+/*!
+ * \brief The stream ended, the best reading wins
+ *
+ * What's still pending ends the last character. \a stamp is where the
+ * last tone ended, that's where the gap after it starts.
+ */
+void DecodeViterbi::flush(qint64 stamp)
+{
+	if (havePending) {
+		gap(3, stamp, true);
+	} else {
+		next = hyps;
+		nextScores = scores;
+		finish();
+		int best = 0;
+		for (int i = 1; i < next.size(); i++)
+			if (nextScores.at(i) > nextScores.at(best))
+				best = i;
+		hyps.clear();
+		hyps.append(next.at(best));
+	}
+	out += hyps.first().text;
+	starts += hyps.first().starts;
+	restart();
+}
@@ -0,0 +1,127 @@
+#ifndef DECODE_VITERBI_H
+#define DECODE_VITERBI_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QString>
+#include <QVector>
+
+
+/*!
+ * \brief Decodes the lengths of tones and gaps with a hidden Markov model
+ *
+ * A threshold decoder like \ref DecodeLevel decides for every tone if
+ * it's a dit or a dah, and for every gap where the character ends. With
+ * a weak or fading signal some of these decisions are wrong, and then
+ * the character is wrong.
+ *
+ * This decoder doesn't decide right away. It keeps the most likely
+ * readings (the beam) of what came so far. A reading is a node in the
+ * decoding tree of \ref Morse::treeToken() plus the text before it. Each
+ * tone and gap makes new readings out of the old ones: the tone was a dit
+ * or a dah, or only noise, the gap was inside of the character, ended it
+ * or ended the word, or it was only a drop out of the signal. Readings that leave the
+ * tree or end a character that doesn't exist die. How likely each one is
+ * comes from the lengths, and from how often the characters follow each
+ * other, see \ref setBigrams().
+ *
+ * When all readings agree on the start of the text, that start is final.
+ *
+ * Usage:
+ * \code
+ *   DecodeViterbi dec;
+ *   dec.tone(1.1, t0);   // lengths in dits
+ *   dec.gap(2.7, t1);
+ *   dec.tone(3.4, t2);
+ *   dec.gap(8, t3, true);
+ *   dec.flush(t4);
+ *   printf("%s\n", qPrintable(dec.text()));
+ * \endcode
+ */
+class DecodeViterbi {
+public:
+	DecodeViterbi(int beam=32);
+	void setBeam(int beam);
+	void setBigrams(const QVector<float> &logProbs, float weight=0.5);
+	static QVector<float> bigrams(const QString &text);
+
+	void tone(float dits, qint64 stamp);
+	void gap(float dits, qint64 stamp, bool open=false);
+	void flush(qint64 stamp);
+
+	void clear();
+	const QString &text() const { return out; } //!< What's final so far
+	QString takeText();
+	/*! \brief Stamp of the first tone of character \a i, or the gap of a space */
+	qint64 charStamp(int i) const { return starts.at(i); }
+
+	static void toneLogProbs(const float *len, int n, float *dit, float *dah);
+	static void gapLogProbs(const float *len, int n, float *intra, float *chr, float *word, float *drop);
+private:
+	/*!
+	 * \brief One reading of the tones and gaps so far
+	 *
+	 * The last tone and gap aren't decided yet, see \ref gap().
+	 */
+	struct Hyp {
+		int node;         //!< \brief Node in the decoding tree, 1 between characters
+		int prev;         //!< \brief Index of the last character, 0 for a space
+		float tone;       //!< \brief Length of the pending tone, 0 if none
+		float gap;        //!< \brief Length of the pending gap
+		qint64 toneStamp; //!< \brief Where the pending tone started
+		qint64 gapStamp;  //!< \brief Where the pending gap started
+		qint64 charStart; //!< \brief Stamp of the first tone of the current character
+		QString text;     //!< \brief Text that isn't final yet
+		QVector<qint64> starts; //!< \brief Stamps of the characters in \ref text
+	};
+
+	void restart();
+	void add(const Hyp &h, float score);
+	void appendChar(Hyp &h, int token, qint64 stamp);
+	void classify(const Hyp &h, float score, float ditLp, float dahLp, const float *gapLp, bool open);
+	void finish();
+	void commit();
+
+	int beam;            //!< \brief Most readings to keep, see \ref setBeam()
+	QVector<float> lm;   //!< \brief Bigram log probabilities times the weight, or empty
+	QVector<Hyp> hyps;   //!< \brief The readings, best first
+	QVector<float> scores;  //!< \brief Log probability of each reading
+
+	QVector<Hyp> next;          //!< \brief New readings, reused
+	QVector<float> nextScores;  //!< \brief Their scores
+	QVector<int> order;         //!< \brief Indices into \ref next, by score
+	QVector<float> toneLens;    //!< \brief Pending tone of each reading
+	QVector<float> gapLens;     //!< \brief Pending gap of each reading
+	QVector<float> ditLp;       //!< \brief Log probability that the pending tone is a dit
+	QVector<float> dahLp;       //!< \brief ... a dah
+	QVector<float> intraLp;     //!< \brief Log probability that the pending gap is inside of a character
+	QVector<float> charLp;      //!< \brief ... between characters
+	QVector<float> wordLp;      //!< \brief ... between words
+	QVector<float> dropLp;      //!< \brief ... a drop out
+
+	bool havePending;    //!< \brief \ref tone() came, \ref gap() not yet
+	float pendingTone;   //!< \brief Length of that tone
+	qint64 pendingStamp; //!< \brief Stamp of that tone
+
+	QString out;              //!< \brief Final text
+	QVector<qint64> starts;   //!< \brief Stamps of the characters in \ref out
+};
+
+
+#endif
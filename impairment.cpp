@@ -0,0 +1,587 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Makes clean morse sound like it came over the air: noise, fading,
+ * static crashes and a receiver filter.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QtAlgorithms>
+#include <math.h>
+#include "impairment.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/*!
+ * \brief Samples per block inside of the stages
+ *
+ * Noise is generated into buffers of this size on the stack.
+ */
+#define BLOCK 256
+
+
+/*!
+ * \brief Samples between two gain steps in \ref FadingStage
+ *
+ * Fading is slow, in between the gain is interpolated linearly.
+ */
+#define FADE_STEP 64
+
+
+/*!
+ * \brief Add \a level times \a in to \a buf
+ */
+static void addScaled(float *buf, const float *in, float level, int n)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128 l = _mm_set1_ps(level);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(buf + i, _mm_add_ps(_mm_loadu_ps(buf + i), _mm_mul_ps(_mm_loadu_ps(in + i), l)));
+#endif
+	for (; i < n; i++)
+		buf[i] += in[i] * level;
+}
+
+
+
+/*!
+ * \brief Random number generator
+ *
+ * @param seed  same seed, same noise
+ */
+NoiseGenerator::NoiseGenerator(quint32 _seed)
+{
+	seed(_seed);
+}
+
+
+/*!
+ * \brief Restart the generator with \a seed
+ *
+ * The four lanes get different states from splitmix32, which never gives
+ * the forbidden all-zero state in practice.
+ */
+void NoiseGenerator::seed(quint32 s)
+{
+	for (int w = 0; w < 4; w++) {
+		for (int lane = 0; lane < 4; lane++) {
+			quint32 z = (s += 0x9e3779b9);
+			z = (z ^ (z >> 16)) * 0x85ebca6b;
+			z = (z ^ (z >> 13)) * 0xc2b2ae35;
+			state[w][lane] = z ^ (z >> 16);
+		}
+	}
+}
+
+
+/*!
+ * \brief Fill \a out with \a n numbers evenly spread in [-1.0, 1.0)
+ */
+void NoiseGenerator::uniform(float *out, int n)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	__m128i s0 = _mm_loadu_si128((const __m128i *)state[0]);
+	__m128i s1 = _mm_loadu_si128((const __m128i *)state[1]);
+	__m128i s2 = _mm_loadu_si128((const __m128i *)state[2]);
+	__m128i s3 = _mm_loadu_si128((const __m128i *)state[3]);
+	const __m128 scale = _mm_set1_ps(1.0f / 8388608);
+	for (; i + 4 <= n; i += 4) {
+		__m128i r = _mm_add_epi32(s0, s3);
+		__m128i t = _mm_slli_epi32(s1, 9);
+		s2 = _mm_xor_si128(s2, s0);
+		s3 = _mm_xor_si128(s3, s1);
+		s1 = _mm_xor_si128(s1, s2);
+		s0 = _mm_xor_si128(s0, s3);
+		s2 = _mm_xor_si128(s2, t);
+		s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+		// upper 24 bits as signed number
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(r, 8)), scale));
+	}
+	_mm_storeu_si128((__m128i *)state[0], s0);
+	_mm_storeu_si128((__m128i *)state[1], s1);
+	_mm_storeu_si128((__m128i *)state[2], s2);
+	_mm_storeu_si128((__m128i *)state[3], s3);
+#endif
+	for (; i < n; i++)
+		out[i] = uniform();
+}
+
+
+/*!
+ * \brief Returns one number evenly spread in [-1.0, 1.0)
+ *
+ * This steps the lanes in turn. It's the slow way, but it gives the same
+ * numbers as the SIMD code in \ref uniform(float *, int).
+ */
+float NoiseGenerator::uniform()
+{
+	// Rotate so that lane 0 is the next one
+	quint32 s0 = state[0][0], s1 = state[1][0], s2 = state[2][0], s3 = state[3][0];
+	quint32 r = s0 + s3;
+	quint32 t = s1 << 9;
+	s2 ^= s0;
+	s3 ^= s1;
+	s1 ^= s2;
+	s0 ^= s3;
+	s2 ^= t;
+	s3 = (s3 << 11) | (s3 >> 21);
+	for (int lane = 0; lane < 3; lane++) {
+		state[0][lane] = state[0][lane + 1];
+		state[1][lane] = state[1][lane + 1];
+		state[2][lane] = state[2][lane + 1];
+		state[3][lane] = state[3][lane + 1];
+	}
+	state[0][3] = s0;
+	state[1][3] = s1;
+	state[2][3] = s2;
+	state[3][3] = s3;
+	return ((qint32)r >> 8) * (1.0f / 8388608);
+}
+
+
+/*!
+ * \brief Fill \a out with \a n normally distributed numbers
+ *
+ * Mean 0, standard deviation 1. This is the sum of four uniform numbers,
+ * which is close enough to a gaussian for noise you listen to, and much
+ * faster than Box-Muller. It never goes beyond +/- 3.5.
+ */
+void NoiseGenerator::gaussian(float *out, int n)
+{
+	float u[4 * BLOCK];
+	while (n > 0) {
+		int len = qMin(n, BLOCK);
+		uniform(u, 4 * len);
+		// sum of four has variance 4/3
+		const float scale = 0.8660254f;
+		int i = 0;
+#if defined(__SSE2__)
+		const __m128 s = _mm_set1_ps(scale);
+		for (; i + 4 <= len; i += 4) {
+			__m128 a = _mm_add_ps(_mm_loadu_ps(u + i), _mm_loadu_ps(u + len + i));
+			__m128 b = _mm_add_ps(_mm_loadu_ps(u + 2 * len + i), _mm_loadu_ps(u + 3 * len + i));
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(a, b), s));
+		}
+#endif
+		for (; i < len; i++)
+			out[i] = (u[i] + u[len + i] + u[2 * len + i] + u[3 * len + i]) * scale;
+		out += len;
+		n -= len;
+	}
+}
+
+
+
+Impairment::Impairment()
+	: rate(SAMPLE_RATE)
+{
+}
+
+
+Impairment::~Impairment()
+{
+}
+
+
+/*!
+ * \brief Tell the stage the sample rate
+ *
+ * Stages that have coefficients depending on it recalculate them.
+ */
+void Impairment::setSampleRate(int _rate)
+{
+	rate = _rate;
+}
+
+
+
+/*!
+ * \brief Noise stage
+ *
+ * @param color  white or pink
+ * @param level  RMS of the noise, 1.0 is full scale. E.g. 0.03 is about
+ *               20 dB below a full scale sine.
+ * @param seed   seed for \ref NoiseGenerator
+ */
+NoiseStage::NoiseStage(Color _color, float _level, quint32 seed)
+	: rng(seed)
+	, color(_color)
+	, level(_level)
+	, b0(0)
+	, b1(0)
+	, b2(0)
+{
+}
+
+
+void NoiseStage::process(float *buf, int n)
+{
+	float noise[BLOCK];
+	while (n > 0) {
+		int len = qMin(n, BLOCK);
+		rng.gaussian(noise, len);
+		if (color == Pink) {
+			// Paul Kellett's economy pink filter, scaled to about unity RMS
+			for (int i = 0; i < len; i++) {
+				float w = noise[i];
+				b0 = 0.99765f * b0 + w * 0.0990460f;
+				b1 = 0.96300f * b1 + w * 0.2965164f;
+				b2 = 0.57000f * b2 + w * 1.0526913f;
+				noise[i] = (b0 + b1 + b2 + w * 0.1848f) * 0.3f;
+			}
+		}
+		addScaled(buf, noise, level, len);
+		buf += len;
+		n -= len;
+	}
+}
+
+
+
+/*!
+ * \brief Fading stage
+ *
+ * @param kind    sinusoidal or Rayleigh
+ * @param rateHz  for sinusoidal fading, how often the signal fades per
+ *                second. For Rayleigh fading, the Doppler spread, e.g.
+ *                0.1 Hz for slow and 2 Hz for flutter.
+ * @param depth   0.0 is no fading at all, 1.0 fades down to nothing
+ * @param seed    seed for \ref NoiseGenerator
+ */
+FadingStage::FadingStage(Kind _kind, float _rateHz, float _depth, quint32 seed)
+	: rng(seed)
+	, kind(_kind)
+	, rateHz(_rateHz)
+	, depth(qBound(0.0f, _depth, 1.0f))
+	, phase(0)
+	, fadeI(1)
+	, fadeQ(1)
+	, gain(1)
+	, target(1)
+	, step(0)
+	, left(0)
+{
+}
+
+
+/*!
+ * \brief Returns the gain after the next \ref FADE_STEP samples
+ */
+float FadingStage::nextGain()
+{
+	float g;
+	if (kind == Sinusoidal) {
+		phase += M_PI * 2 * rateHz * FADE_STEP / rate;
+		if (phase > M_PI * 2)
+			phase -= M_PI * 2;
+		g = 0.5f + 0.5f * cos(phase);
+	} else {
+		// Two low-passed gaussians with unit variance each
+		float a = exp(-M_PI * 2 * rateHz * FADE_STEP / rate);
+		float b = sqrt(1 - a * a);
+		float x[2];
+		rng.gaussian(x, 2);
+		fadeI = a * fadeI + b * x[0];
+		fadeQ = a * fadeQ + b * x[1];
+		// Rayleigh distributed with mean power 1
+		g = sqrt((fadeI * fadeI + fadeQ * fadeQ) * 0.5f);
+	}
+	return 1 - depth + depth * g;
+}
+
+
+/*!
+ * \brief Apply the fading to \a n samples
+ *
+ * The gain changes every \ref FADE_STEP samples, no matter how the caller
+ * cuts the audio into buffers. A step can span several calls.
+ */
+void FadingStage::process(float *buf, int n)
+{
+	while (n > 0) {
+		if (!left) {
+			target = nextGain();
+			step = (target - gain) / FADE_STEP;
+			left = FADE_STEP;
+		}
+		int len = qMin(n, left);
+
+		int i = 0;
+#if defined(__SSE2__)
+		__m128 g = _mm_setr_ps(gain, gain + step, gain + 2 * step, gain + 3 * step);
+		const __m128 s = _mm_set1_ps(4 * step);
+		for (; i + 4 <= len; i += 4) {
+			_mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+			g = _mm_add_ps(g, s);
+		}
+#endif
+		for (; i < len; i++)
+			buf[i] *= gain + i * step;
+
+		left -= len;
+		gain = left ? gain + len * step : target;
+		buf += len;
+		n -= len;
+	}
+}
+
+
+
+/*!
+ * \brief Static crash stage
+ *
+ * @param _perSecond  average number of crashes per second
+ * @param _level      average peak RMS of a crash, 1.0 is full scale
+ * @param _decayMs    time in which a crash decays to 1/e
+ * @param seed        seed for \ref NoiseGenerator
+ */
+QrnStage::QrnStage(float _perSecond, float _level, float _decayMs, quint32 seed)
+	: rng(seed)
+	, perSecond(_perSecond)
+	, level(_level)
+	, decayMs(_decayMs)
+	, env(0)
+{
+	setSampleRate(rate);
+}
+
+
+void QrnStage::setSampleRate(int _rate)
+{
+	Impairment::setSampleRate(_rate);
+	decay = exp(-1000.0 / (decayMs * rate));
+}
+
+
+void QrnStage::process(float *buf, int n)
+{
+	float noise[BLOCK];
+	// Chance of a crash in a block
+	const float chance = perSecond * BLOCK / rate;
+	while (n > 0) {
+		int len = qMin(n, BLOCK);
+		int start = -1;
+		if (rng.uniform() * 0.5f + 0.5f < chance * len / BLOCK)
+			start = (int)((rng.uniform() * 0.5f + 0.5f) * len);
+
+		// Nothing to hear, skip the noise
+		if (start < 0 && env < 1e-5f) {
+			env = 0;
+			buf += len;
+			n -= len;
+			continue;
+		}
+
+		rng.gaussian(noise, len);
+		for (int i = 0; i < len; i++) {
+			if (i == start)
+				env += level * (0.5f + (rng.uniform() * 0.5f + 0.5f));
+			buf[i] += env * noise[i];
+			env *= decay;
+		}
+		buf += len;
+		n -= len;
+	}
+}
+
+
+
+/*!
+ * \brief Band-pass stage, like the CW filter of a receiver
+ *
+ * @param _centerHz  center frequency, usually the pitch of the signal
+ * @param _widthHz   bandwidth, e.g. 500 Hz
+ * @param count      number of biquads. More of them give steeper
+ *                   slopes and a narrower passband.
+ */
+BandpassStage::BandpassStage(float _centerHz, float _widthHz, int count)
+	: sections(qMax(1, count))
+	, centerHz(_centerHz)
+	, widthHz(_widthHz)
+{
+	for (int s = 0; s < sections.size(); s++)
+		sections[s].z1 = sections[s].z2 = 0;
+	setSampleRate(rate);
+}
+
+
+/*!
+ * \brief Calculate the coefficients
+ *
+ * This is the constant 0 dB peak gain band-pass of Robert
+ * Bristow-Johnson's audio EQ cookbook.
+ */
+void BandpassStage::setSampleRate(int _rate)
+{
+	Impairment::setSampleRate(_rate);
+
+	double w0 = M_PI * 2 * centerHz / rate;
+	double q = centerHz / qMax(widthHz, 1.0f);
+	double alpha = sin(w0) / (2 * q);
+	double a0 = 1 + alpha;
+	b0 = alpha / a0;
+	a1 = -2 * cos(w0) / a0;
+	a2 = (1 - alpha) / a0;
+}
+
+
+void BandpassStage::process(float *buf, int n)
+{
+	// Each section is recursive, so this goes sample by sample
+	for (int s = 0; s < sections.size(); s++) {
+		float z1 = sections[s].z1;
+		float z2 = sections[s].z2;
+		for (int i = 0; i < n; i++) {
+			float x = buf[i];
+			float y = b0 * x + z1;
+			z1 = z2 - a1 * y;
+			z2 = -b0 * x - a2 * y;
+			buf[i] = y;
+		}
+		sections[s].z1 = z1;
+		sections[s].z2 = z2;
+	}
+}
+
+
+
+/*!
+ * \brief Chain of impairments
+ *
+ * @param sampleRate  sample rate for all stages
+ */
+ImpairmentChain::ImpairmentChain(int sampleRate)
+	: rate(sampleRate)
+{
+}
+
+
+/*!
+ * \brief Class destructor
+ *
+ * Deletes all stages.
+ */
+ImpairmentChain::~ImpairmentChain()
+{
+	clear();
+}
+
+
+/*!
+ * \brief Change the sample rate of all stages
+ */
+void ImpairmentChain::setSampleRate(int sampleRate)
+{
+	rate = sampleRate;
+	foreach(Impairment *stage, stages)
+		stage->setSampleRate(rate);
+}
+
+
+/*!
+ * \brief Append \a stage at the end of the chain
+ *
+ * The chain takes ownership of the stage.
+ */
+void ImpairmentChain::append(Impairment *stage)
+{
+	stage->setSampleRate(rate);
+	stages.append(stage);
+}
+
+
+/*!
+ * \brief Delete all stages
+ */
+void ImpairmentChain::clear()
+{
+	qDeleteAll(stages);
+	stages.clear();
+}
+
+
+/*!
+ * \brief Returns true if there's no stage
+ */
+bool ImpairmentChain::isEmpty() const
+{
+	return stages.isEmpty();
+}
+
+
+/*!
+ * \brief Run \a n samples in \a buf through all stages
+ */
+void ImpairmentChain::process(float *buf, int n)
+{
+	foreach(Impairment *stage, stages)
+		stage->process(buf, n);
+}
+
+
+/*!
+ * \brief Run \a n 16 bit samples through all stages
+ *
+ * They're converted to float and back, loud parts get clipped.
+ */
+void ImpairmentChain::process(qint16 *buf, int n)
+{
+	float f[BLOCK];
+	while (n > 0) {
+		int len = qMin(n, BLOCK);
+		int i = 0;
+#if defined(__SSE2__)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 in = _mm_set1_ps(1.0f / 32768);
+		const __m128 out = _mm_set1_ps(32768.0f);
+		for (; i + 8 <= len; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+			__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, x), 16));
+			__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, x), 16));
+			_mm_storeu_ps(f + i, _mm_mul_ps(lo, in));
+			_mm_storeu_ps(f + i + 4, _mm_mul_ps(hi, in));
+		}
+#endif
+		for (; i < len; i++)
+			f[i] = buf[i] * (1.0f / 32768);
+
+		process(f, len);
+
+		i = 0;
+#if defined(__SSE2__)
+		for (; i + 8 <= len; i += 8) {
+			// packs saturates, that's the clipping
+			__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(f + i), out));
+			__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(f + i + 4), out));
+			_mm_storeu_si128((__m128i *)(buf + i), _mm_packs_epi32(lo, hi));
+		}
+#endif
+		for (; i < len; i++)
+			buf[i] = (qint16)qBound(-32768L, lrintf(f[i] * 32768), 32767L);
+		buf += len;
+		n -= len;
+	}
+}
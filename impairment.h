@@ -0,0 +1,189 @@
+#ifndef IMPAIRMENT_H
+#define IMPAIRMENT_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QList>
+#include <QVector>
+
+#include "sinesource.h"
+
+
+/*!
+ * \brief Fast pseudo random numbers for noise
+ *
+ * Four interleaved xoshiro128+ generators, so that four numbers come out
+ * of one SIMD step. This isn't good enough for cryptography, but more
+ * than good enough for noise.
+ */
+class NoiseGenerator {
+public:
+	NoiseGenerator(quint32 seed=1);
+	void seed(quint32 seed);
+	void uniform(float *out, int n);
+	void gaussian(float *out, int n);
+	float uniform();
+private:
+	quint32 state[4][4]; //!< \brief state[word][lane]
+};
+
+
+/*!
+ * \brief One stage in an \ref ImpairmentChain
+ *
+ * Stages work on mono float samples, where 1.0 is full scale.
+ */
+class Impairment {
+public:
+	virtual ~Impairment();
+	virtual void setSampleRate(int rate);
+	/*! \brief Impair \a n samples in \a buf in place */
+	virtual void process(float *buf, int n) = 0;
+protected:
+	Impairment();
+	int rate;  //!< \brief Sample rate, see \ref setSampleRate()
+};
+
+
+/*!
+ * \brief Adds white or pink noise (AWGN)
+ */
+class NoiseStage : public Impairment {
+public:
+	/*! \brief Spectrum of the noise */
+	enum Color {
+		White,  //!< \brief same power at every frequency
+		Pink    //!< \brief 3 dB less per octave, sounds more like a band
+	};
+	NoiseStage(Color color, float level, quint32 seed=1);
+	void process(float *buf, int n);
+private:
+	NoiseGenerator rng;
+	Color color;
+	float level;  //!< \brief RMS of the noise
+	float b0;     //!< \brief State of the pink filter
+	float b1;     //!< \brief State of the pink filter
+	float b2;     //!< \brief State of the pink filter
+};
+
+
+/*!
+ * \brief Signal fading (QSB)
+ */
+class FadingStage : public Impairment {
+public:
+	/*! \brief How the signal fades */
+	enum Kind {
+		Sinusoidal,  //!< \brief slow, regular up and down
+		Rayleigh     //!< \brief random, like multipath on HF
+	};
+	FadingStage(Kind kind, float rateHz, float depth=1.0, quint32 seed=1);
+	void process(float *buf, int n);
+private:
+	float nextGain();
+
+	NoiseGenerator rng;
+	Kind kind;
+	float rateHz;  //!< \brief Fading frequency or Doppler spread
+	float depth;   //!< \brief 0.0 is no fading, 1.0 fades completely
+	double phase;  //!< \brief Phase of the \ref Sinusoidal fading
+	float fadeI;   //!< \brief In-phase part of \ref Rayleigh fading
+	float fadeQ;   //!< \brief Quadrature part of \ref Rayleigh fading
+	float gain;    //!< \brief Gain of the next sample
+	float target;  //!< \brief Gain at the end of the current step
+	float step;    //!< \brief Change of the gain per sample
+	int left;      //!< \brief Samples until \ref target, 0 for a new step
+};
+
+
+/*!
+ * \brief Static crashes (QRN)
+ *
+ * Crashes come at random times. Each one is a burst of noise that starts
+ * suddenly and then decays exponentially.
+ */
+class QrnStage : public Impairment {
+public:
+	QrnStage(float perSecond, float level, float decayMs=30, quint32 seed=1);
+	void setSampleRate(int rate);
+	void process(float *buf, int n);
+private:
+	NoiseGenerator rng;
+	float perSecond;  //!< \brief Average crashes per second
+	float level;      //!< \brief Average peak of a crash
+	float decayMs;    //!< \brief Time in which a crash falls to 1/e
+	float decay;      //!< \brief Decay per sample
+	float env;        //!< \brief Current envelope of the crash
+};
+
+
+/*!
+ * \brief Receiver filter: band-pass made of biquad sections
+ */
+class BandpassStage : public Impairment {
+public:
+	BandpassStage(float centerHz, float widthHz, int sections=2);
+	void setSampleRate(int rate);
+	void process(float *buf, int n);
+private:
+	/*! \brief One biquad, transposed direct form II */
+	struct Section {
+		float z1, z2;
+	};
+	QVector<Section> sections;
+	float centerHz;
+	float widthHz;
+	float b0;  //!< \brief Coefficient, b1 is 0 and b2 is -b0
+	float a1;  //!< \brief Coefficient
+	float a2;  //!< \brief Coefficient
+};
+
+
+/*!
+ * \brief Chain of \ref Impairment stages
+ *
+ * Usage:
+ * \code
+ *   ImpairmentChain *chain = new ImpairmentChain;
+ *   chain->append(new FadingStage(FadingStage::Rayleigh, 0.2));
+ *   chain->append(new NoiseStage(NoiseStage::Pink, 0.05));
+ *   chain->append(new QrnStage(0.5, 0.3));
+ *   chain->append(new BandpassStage(800, 500));
+ *   render.setImpairments(chain);
+ * \endcode
+ *
+ * Set the chain up before samples flow through it, it doesn't lock.
+ */
+class ImpairmentChain {
+public:
+	ImpairmentChain(int sampleRate=SAMPLE_RATE);
+	~ImpairmentChain();
+	void setSampleRate(int sampleRate);
+	void append(Impairment *stage);
+	void clear();
+	bool isEmpty() const;
+	void process(float *buf, int n);
+	void process(qint16 *buf, int n);
+private:
+	QList<Impairment *> stages;  //!< \brief Owned stages, in order
+	int rate;                    //!< \brief Sample rate of all stages
+};
+
+
+#endif
@@ -7,6 +7,7 @@ MOC_DIR     = .obj
 RCC_DIR     = .obj
 OBJECTS_DIR = .obj
 MVG_DIR     = .obj
+MORSETABLE_DIR = .obj
 
 CONFIG -= release
 CONFIG *= debug
@@ -17,4 +18,11 @@ TARGET  =  main
 
 QMAKE_CLEAN *= $$DESTDIR/$$TARGET
 
+# Use AVX2 in the sample loops, e.g. "qmake CONFIG+=avx2"
+avx2:QMAKE_CXXFLAGS *= -mavx2
+
+# clock_nanosleep() for MorseScheduler, needed by older glibc
+unix:!macx:LIBS *= -lrt
+
 include($$TOPDIR/mvg.pri)
+include($$TOPDIR/morsetable.pri)
@@ -34,248 +34,1444 @@
 #include "characters.h"
 
 #include <QTimer>
+#include <QVector>
+#include <QFile>
+#include <QMutexLocker>
+
+#include <limits.h>
+
+
+/*
+ * Section: character lookup
+ */
+
+#include "characters_table.h"
+
+/*!
+ * \brief Consult \c chars before the static table?
+ *
+ * \sa Morse::setOverlay()
+ */
+static bool useOverlay = false;
+
+/*!
+ * \brief Tokens of \c chars, filled by \ref Morse::setOverlay()
+ */
+static QHash<QString, int> overlayTokens;
+
+/*!
+ * \brief Tokens are stored in one byte, see \ref GenerateMorse::tokens
+ */
+const int maxTokens = 256;
+
+/*!
+ * \brief Morse code of each token
+ *
+ * The first \c morseTableSize tokens are the entries of the static table,
+ * further tokens get registered by \ref Morse::token(). An entry never
+ * changes once it's there, so it can be read without a lock.
+ */
+static MorseCode tokenCodes[maxTokens];
+
+/*! \brief Clear text of each token, see \ref tokenCodes */
+static QString tokenSigns[maxTokens];
+
+/*! \brief Used entries of \ref tokenCodes, protected by \ref tokenMutex */
+static int tokenCount = 0;
+
+/*! \brief Protects the registration of new tokens */
+static QMutex tokenMutex;
+
+/*! \brief Token of the word space, see \ref Morse::spaceToken() */
+static int spaceTok = -1;
+
+/*!
+ * \brief Node of the tokenizer trie
+ *
+ * \sa Morse::matchToken()
+ */
+struct TrieNode {
+	ushort ch;    //!< \brief Character that leads to this node
+	qint16 token; //!< \brief Token of the sign that ends here, or -1
+	qint16 child; //!< \brief First child node, or -1
+	qint16 next;  //!< \brief Next sibling node, or -1
+};
+
+/*!
+ * \brief Trie over the signs of all tokens, node 0 is the root
+ *
+ * \sa buildTrie()
+ */
+static QVector<TrieNode> trie;
+
+/*!
+ * \brief Children of the trie root, indexed by ASCII character
+ */
+static qint16 trieRoot[128];
+
+/*!
+ * \brief Decoding tree, see \ref Morse::treeToken()
+ *
+ * \sa buildTree()
+ */
+static QVector<qint16> tree;
+
+static void buildTrie();
+static void buildTree();
+
+
+/*!
+ * \brief Pack a string representation of morse code
+ *
+ * @param dahdits  morse code, e.g. "-.". Anything besides '.' and '-' is
+ *                 ignored, so " " gives the word space.
+ */
+MorseCode MorseCode::fromString(const QString &dahdits)
+{
+	MorseCode code;
+	code.bits = 0;
+	code.len = 0;
+	for (int i = 0; i < dahdits.size() && code.len < 16; i++) {
+		char c = dahdits.at(i).toAscii();
+		if (c == '-')
+			code.bits |= 1 << code.len;
+		if (c == '.' || c == '-')
+			code.len++;
+	}
+	return code;
+}
+
+
+/*!
+ * \brief Unpack into string representation, e.g. "-."
+ */
+QString MorseCode::toString() const
+{
+	if (!len)
+		return " ";
+
+	QString s(len, '.');
+	for (int i = 0; i < len; i++)
+		if (bits & (1 << i))
+			s[i] = '-';
+	return s;
+}
+
+
+/*!
+ * \brief Hash function for the perfect hash in \c characters_table.h
+ *
+ * This is FNV-1a over the UTF-16 code units, modified by \c morseHashSeed.
+ * \c morsetable.py searched for a seed where no two characters of the
+ * table end up in the same slot, so we need exactly one compare.
+ *
+ * \note Must be the same as morseHash() in \c morsetable.py
+ */
+static inline quint32 morseHash(const QChar *s, int len)
+{
+	quint32 h = 2166136261u ^ morseHashSeed;
+	for (int i = 0; i < len; i++) {
+		h ^= s[i].unicode();
+		h *= 16777619u;
+	}
+	return h >> morseHashShift;
+}
+
+
+/*!
+ * \brief Find a character in the static table
+ *
+ * This doesn't allocate anything and needs one hash calculation plus one
+ * compare, regardless of the size of the table. The runtime-editable \c
+ * chars list isn't consulted here, even when \ref setOverlay() is on.
+ *
+ * @param clearText  characters to look up, e.g. "a" or "AR"
+ * @param len        number of characters in \a clearText
+ * @returns          table entry, or 0 if there is no morse code for it
+ */
+const MorseTableEntry *Morse::lookup(const QChar *clearText, int len) const
+{
+	int idx = morseHashSlots[morseHash(clearText, len)];
+	if (idx < 0)
+		return 0;
+
+	const MorseTableEntry *e = &morseTable[idx];
+	if (e->len != len)
+		return 0;
+	for (int i = 0; i < len; i++)
+		if (clearText[i].unicode() != (uchar)e->sign[i])
+			return 0;
+	return e;
+}
+
+
+/*!
+ * \brief Find the token for some characters
+ *
+ * Like \ref lookup(), but also honors \ref setOverlay().
+ *
+ * @param clearText  characters to look up, e.g. "a" or "AR"
+ * @param len        number of characters in \a clearText
+ * @returns          token, or -1 if there is no morse code for \a clearText
+ */
+int Morse::findToken(const QChar *clearText, int len) const
+{
+	if (useOverlay && !overlayTokens.isEmpty()) {
+		QHash<QString, int>::const_iterator it =
+			overlayTokens.constFind(QString::fromRawData(clearText, len));
+		if (it != overlayTokens.constEnd())
+			return it.value();
+	}
+
+	const MorseTableEntry *e = lookup(clearText, len);
+	if (!e)
+		return -1;
+	return e - morseTable;
+}
+
+
+/*!
+ * \brief Find the packed morse code for some characters
+ *
+ * @param clearText  characters to look up, e.g. "a" or "AR"
+ * @param len        number of characters in \a clearText
+ * @param code       receives the morse code
+ * @returns          true if there is morse code for \a clearText
+ */
+bool Morse::find(const QChar *clearText, int len, MorseCode *code) const
+{
+	int token = findToken(clearText, len);
+	if (token < 0)
+		return false;
+	*code = tokenCode(token);
+	return true;
+}
+
+
+/*!
+ * \brief Also use the runtime-editable \c chars list
+ *
+ * Normally the morse code comes from the static table that has been
+ * generated out of \c characters.csv. When the overlay is on, then the
+ * characters in \c chars (e.g. as loaded by \c loadChars() and edited in
+ * the table view) win over the static table.
+ *
+ * The codes from \c chars are packed once, when this is called. So call it
+ * again after \c chars has been modified. This rebuilds the lookup tables,
+ * so no other thread may use morse code while it runs.
+ */
+void Morse::setOverlay(bool on)
+{
+	MYTRACE("Morse::setOverlay(%d)", on);
+
+	useOverlay = on;
+	overlayTokens.clear();
+	if (on) {
+		foreach(const MorseCharacter &m, chars) {
+			if (m.sign.isEmpty())
+				continue;
+			int t = token(m.sign, MorseCode::fromString(m.code));
+			if (t >= 0)
+				overlayTokens.insert(m.sign, t);
+		}
+	}
+	buildTrie();
+	buildTree();
+}
+
+
+bool Morse::overlay()
+{
+	return useOverlay;
+}
+
+
+/*!
+ * \brief Character of a text as UTF-16 code unit
+ */
+static inline ushort unit(QChar c)
+{
+	return c.unicode();
+}
+
+
+/*!
+ * \brief Character of a Latin-1 text as UTF-16 code unit
+ */
+static inline ushort unit(char c)
+{
+	return (uchar)c;
+}
+
+
+/*!
+ * \brief Find the child of trie node \a node for character \a c
+ *
+ * @returns node index, or -1
+ */
+static inline int trieChild(int node, ushort c)
+{
+	if (!node && c < 128)
+		return trieRoot[c];
+	for (int n = trie.at(node).child; n >= 0; n = trie.at(n).next)
+		if (trie.at(n).ch == c)
+			return n;
+	return -1;
+}
+
+
+/*!
+ * \brief Add \a sign to the trie
+ */
+static void trieInsert(const QString &sign, int token)
+{
+	int node = 0;
+	foreach(QChar c, sign) {
+		int n = trieChild(node, c.unicode());
+		if (n < 0) {
+			TrieNode t;
+			t.ch = c.unicode();
+			t.token = -1;
+			t.child = -1;
+			t.next = trie.at(node).child;
+			n = trie.count();
+			trie.append(t);
+			trie[node].child = n;
+			if (!node && t.ch < 128)
+				trieRoot[t.ch] = n;
+		}
+		node = n;
+	}
+	trie[node].token = token;
+}
+
+
+/*!
+ * \brief Build \ref trie out of the static table and the overlay
+ *
+ * The overlay gets inserted last, so it's tokens win.
+ */
+static void buildTrie()
+{
+	trie.clear();
+	TrieNode root;
+	root.ch = 0;
+	root.token = -1;
+	root.child = -1;
+	root.next = -1;
+	trie.append(root);
+	for (int i = 0; i < 128; i++)
+		trieRoot[i] = -1;
+
+	for (int i = 0; i < morseTableSize; i++)
+		trieInsert(QString::fromLatin1(morseTable[i].sign), i);
+	for (QHash<QString, int>::const_iterator it = overlayTokens.constBegin();
+	     it != overlayTokens.constEnd(); ++it)
+		trieInsert(it.key(), it.value());
+	MYVERBOSE("trie has %d nodes", trie.count());
+}
+
+
+/*!
+ * \brief Tokenizer, see \ref Morse::matchToken()
+ */
+template <typename C>
+static int matchTrie(const C *text, int len, int *matched)
+{
+	*matched = 1;
+	if (len <= 0)
+		return -1;
+
+	// Walk down the trie as far as the text allows and remember the
+	// longest sign we passed by
+	int token = -1;
+	int node = trieChild(0, unit(text[0]));
+	for (int i = 1; node >= 0; i++) {
+		if (trie.at(node).token >= 0) {
+			token = trie.at(node).token;
+			*matched = i;
+		}
+		if (i == len)
+			break;
+		node = trieChild(node, unit(text[i]));
+	}
+
+	// Upper-case characters that aren't a pro-sign are taken as normal
+	// characters
+	QChar c = unit(text[0]);
+	if (token < 0 && c.isUpper()) {
+		node = trieChild(0, c.toLower().unicode());
+		if (node >= 0)
+			token = trie.at(node).token;
+	}
+	return token;
+}
+
+
+/*!
+ * \brief Find the token at the start of a text
+ *
+ * This is the tokenizer for clear text. It uses a trie over the signs of
+ * the table (and the \ref setOverlay()) and does a greedy longest match,
+ * so pro-signs of any length are found in one go. Upper-case characters
+ * that don't start a pro-sign are taken as their lower-case version.
+ *
+ * @param text     clear text
+ * @param len      number of characters in \a text
+ * @param matched  receives the number of characters used up, at least 1
+ * @returns        token, or -1 if there's no morse code for the first
+ *                 character of \a text
+ */
+int Morse::matchToken(const QChar *text, int len, int *matched) const
+{
+	return matchTrie(text, len, matched);
+}
+
+
+/*!
+ * \brief Find the token at the start of a Latin-1 text
+ *
+ * \sa matchToken(const QChar *, int, int *)
+ */
+int Morse::matchToken(const char *text, int len, int *matched) const
+{
+	return matchTrie(text, len, matched);
+}
+
+
+/*!
+ * \brief Fill \ref tokenCodes and \ref tokenSigns with the static table
+ */
+static void initTokens()
+{
+	for (int i = 0; i < morseTableSize; i++) {
+		tokenCodes[i] = morseTable[i].code;
+		tokenSigns[i] = QString::fromLatin1(morseTable[i].sign);
+	}
+	tokenCount = morseTableSize;
+}
+
+
+/*!
+ * \brief Return the token for clear text and it's morse code
+ *
+ * Tokens are small numbers that stand for one entry of the character table.
+ * \ref GenerateMorse stores them instead of strings. Entries of the static
+ * table have fixed tokens, everything else (e.g. from the \ref setOverlay()
+ * or from \ref GenerateMorse::appendMorse()) get's registered here. This
+ * may be called from any thread.
+ *
+ * @param clearText  e.g. "a"
+ * @param code       morse code for \a clearText
+ * @returns          token, or -1 when all tokens are used up
+ */
+int Morse::token(const QString &clearText, const MorseCode &code)
+{
+	const MorseTableEntry *e = Morse().lookup(clearText.constData(), clearText.size());
+	if (e && e->code.bits == code.bits && e->code.len == code.len)
+		return e - morseTable;
+
+	QMutexLocker lock(&tokenMutex);
+	for (int i = morseTableSize; i < tokenCount; i++) {
+		if (tokenCodes[i].bits == code.bits &&
+		    tokenCodes[i].len == code.len &&
+		    tokenSigns[i] == clearText)
+			return i;
+	}
+
+	if (tokenCount == maxTokens) {
+		qWarning("no more morse tokens for '%s'", qPrintable(clearText));
+		return -1;
+	}
+	tokenCodes[tokenCount] = code;
+	tokenSigns[tokenCount] = clearText;
+	return tokenCount++;
+}
+
+
+/*!
+ * \brief Token of the word space " "
+ */
+int Morse::spaceToken()
+{
+	return spaceTok;
+}
+
+
+/*!
+ * \brief Morse code of a token
+ */
+MorseCode Morse::tokenCode(int token)
+{
+	if (token < morseTableSize)
+		return morseTable[token].code;
+	return tokenCodes[token];
+}
+
+
+/*!
+ * \brief Clear text of a token
+ */
+const QString &Morse::tokenSign(int token)
+{
+	return tokenSigns[token];
+}
+
+
+/*!
+ * \brief Add \a token to the decoding tree, unless it's place is taken
+ */
+static void treeInsert(int token)
+{
+	MorseCode code = Morse::tokenCode(token);
+	if (!code.len || code.len > Morse::treeDepth)
+		return;
+
+	int node = 1;
+	for (int i = 0; i < code.len; i++)
+		node = 2 * node + ((code.bits >> i) & 1);
+	if (tree.at(node) < 0)
+		tree[node] = token;
+}
+
+
+/*!
+ * \brief Fill \ref tree out of the static table and the overlay
+ *
+ * Some codes are in the table more than once (e.g. "---" is "o", but also
+ * some pro-signs). The first one wins, which is the normal character.
+ */
+static void buildTree()
+{
+	tree.fill(-1, Morse::treeSize);
+	for (int i = 0; i < morseTableSize; i++)
+		treeInsert(i);
+	for (QHash<QString, int>::const_iterator it = overlayTokens.constBegin();
+	     it != overlayTokens.constEnd(); ++it)
+		treeInsert(it.value());
+}
+
+
+/*!
+ * \brief Look up a node of the decoding tree
+ *
+ * The decoding tree is a binary tree stored in an array, so that decoding
+ * a dit or dah is just one multiplication. The root is node 1, and from
+ * node \c n a dit leads to node \c 2n and a dah to node \c 2n+1. So ".-"
+ * ends in node 5.
+ *
+ * @param node  node index, 1 to \ref treeSize - 1
+ * @returns     token of the character that has this code, or -1
+ *
+ * \sa DecodeMorse
+ */
+int Morse::treeToken(int node)
+{
+	return tree.at(node);
+}
+
+
+/*!
+ * \brief Builds the tables above when the program starts
+ *
+ * The decoders and generators run in many threads at once. With the
+ * tables complete before main() they only ever read them, and need no
+ * lock. Only new tokens get registered later, see \ref Morse::token().
+ */
+static struct MorseTables {
+	MorseTables()
+	{
+		initTokens();
+		MorseCode space;
+		space.bits = 0;
+		space.len = 0;
+		spaceTok = Morse::token(" ", space);
+		buildTrie();
+		buildTree();
+	}
+} morseTables;
 
 
 bool Morse::contains(const QString &clearText) const
 {
 	MYTRACE("Morse::contains(%s)", qPrintable(clearText));
-	foreach(MorseCharacter m, chars) {
-		MYVERBOSE("  at %s", qPrintable(m.sign));
-		if (m.sign == clearText)
-			return true;
+
+	return findToken(clearText.constData(), clearText.size()) >= 0;
+}
+
+const QString Morse::operator[] (const QString &clearText) const
+{
+	MYTRACE("Morse::operator[](%s)", qPrintable(clearText));
+
+	MorseCode code;
+	if (find(clearText.constData(), clearText.size(), &code))
+		return code.toString();
+	return QString::null;
+}
+
+
+/*!
+ * \brief Class to generate morse code
+ *
+ * Simple usage:
+ * \code
+ *   GenerateMorse *morse = new GenerateMorse(this);
+ *   connect(morse, SIGNAL(playSound(int)), audio, SLOT(playSound(int)) );
+ *   morse->append("73 de");
+ *   morse->append("dh3hs");
+ *   morse->play();
+ * \endcode
+ */
+GenerateMorse::GenerateMorse(QObject *parent)
+	: QObject(parent)
+	, compact(false)
+	, tailStop(false)
+	, substToken(-1)
+	, playElement(0)
+	, playIdx(0)
+	, clearIdx(0)
+	, playToken(0)
+	, playSub(0)
+	, playNs(0)
+	, timingValid(false)
+	, playMutex(QMutex::Recursive)
+	, scheduler(0)
+	, playLoop(false)
+	, playWpm(5)
+	, ditFactor(1)
+	, dahFactor(1)
+	, intraFactor(1)
+	, charFactor(1)
+	, wordFactor(1)
+{
+	MYTRACE("GenerateMorse::GenerateMorse");
+
+	playTimer = new QTimer(this);
+	playTimer->setSingleShot(true);
+	connect(playTimer, SIGNAL(timeout()), this, SLOT(slotPlayNext()) );
+
+	setSubstitute("?");
+}
+
+
+GenerateMorse::~GenerateMorse()
+{
+	// The thread uses our members, so it must be gone before them
+	delete scheduler;
+}
+
+
+/*
+ * Section: adding morse characters and cleartext
+ */
+
+/* NOTE: all values must be different ! */
+const int ditLength = 1;
+const int dahLength = 3;
+const int intraSpacing = -1;
+const int charSpacing = -3;
+const int wordSpacing = -7;
+
+/*!
+ * \brief Number of elements a morse code expands to
+ *
+ * That is a \c 0 for the clear text, the dits and dahs with intra-character
+ * spacings between them and the character spacing. The word space " " is
+ * just a \c 0 and the word spacing.
+ */
+static inline int codeElements(const MorseCode &code)
+{
+	return code.len ? 2 * code.len + 1 : 2;
+}
+
+
+/*!
+ * \brief Element \a n of the expansion of a morse code
+ *
+ * \sa codeElements()
+ */
+static inline int codeElement(const MorseCode &code, int n)
+{
+	if (!n)
+		return 0;
+	if (!code.len)
+		return wordSpacing;
+	if (n == 2 * code.len)
+		return charSpacing;
+	if (n & 1)
+		return (code.bits >> (n / 2)) & 1 ? dahLength : ditLength;
+	return intraSpacing;
+}
+
+
+/*!
+ * \brief Number of 1 bits, that is the number of dahs in \a bits
+ */
+static inline int bitCount(quint16 bits)
+{
+	int n = 0;
+	for (; bits; n++)
+		bits &= bits - 1;
+	return n;
+}
+
+
+/*!
+ * \brief Add the expansion of \a code to the counts
+ *
+ * \sa codeElements()
+ */
+void MorseCount::add(const MorseCode &code)
+{
+	elements += codeElements(code);
+	if (!code.len) {
+		words++;
+		return;
+	}
+	int n = bitCount(code.bits);
+	dahs += n;
+	dits += code.len - n;
+	intras += code.len - 1;
+	chars++;
+}
+
+
+/*!
+ * \brief Remove the expansion of \a code from the counts
+ */
+void MorseCount::subtract(const MorseCode &code)
+{
+	elements -= codeElements(code);
+	if (!code.len) {
+		words--;
+		return;
+	}
+	int n = bitCount(code.bits);
+	dahs -= n;
+	dits -= code.len - n;
+	intras -= code.len - 1;
+	chars--;
+}
+
+
+/*!
+ * \brief Add one element like in \ref GenerateMorse::morse
+ */
+void MorseCount::addElement(int elem)
+{
+	elements++;
+	switch (elem) {
+	case ditLength: dits++; break;
+	case dahLength: dahs++; break;
+	case intraSpacing: intras++; break;
+	case charSpacing: chars++; break;
+	case wordSpacing: words++; break;
+	}
+}
+
+
+/*!
+ * \brief Sum of the lengths of the elements
+ *
+ * That's the duration in dit lengths, if all factors are 1.0.
+ */
+int MorseCount::units() const
+{
+	return dits * ditLength
+		+ dahs * dahLength
+		- intras * intraSpacing
+		- chars * charSpacing
+		- words * wordSpacing;
+}
+
+
+/*!
+ * \brief Add morse code (in string representation) to morse storage
+ *
+ * @param dahdits  string representation of morse, e.g. "-."
+ * @param clear    clear-text of the same
+ *
+ * \sa appendMorse(const MorseCode &, const QString &)
+ */
+void GenerateMorse::appendMorse(const QString &dahdits, const QString &clear)
+{
+	appendMorse(MorseCode::fromString(dahdits), clear);
+}
+
+
+/*!
+ * \brief Add morse code to morse storage
+ *
+ * @param code   morse code, e.g. as found by \ref Morse::find()
+ * @param clear  clear-text of the same
+ *
+ * \sa appendToken
+ */
+void GenerateMorse::appendMorse(const MorseCode &code, const QString &clear)
+{
+	int token = Morse::token(clear, code);
+	if (token >= 0)
+		appendToken(token);
+}
+
+
+/*!
+ * \brief Add a token to morse storage
+ *
+ * The token get's stored in \ref tokens. Unless we're in compact mode, the
+ * packed morse code of the token will also be converted into lengths of
+ * dits and dahs, but also into spacings (intra-character spacing, between
+ * character spacing, word spacing) and then added to \ref morse. The
+ * cleartext is then also added to \ref clearText.
+ *
+ * @param token  token, as returned by \ref Morse::findToken()
+ *
+ * \sa append
+ */
+void GenerateMorse::appendToken(int token)
+{
+	MorseCode code = Morse::tokenCode(token);
+	MYTRACE("GenerateMorse::appendToken(%d: 0x%x/%d)",
+	        token, code.bits, code.len);
+
+	setTailStop(false);
+	if (!(tokens.size() % checkpointDistance))
+		checkpoints.append(total);
+	tokens.append((char)token);
+	total.add(code);
+	if (compact)
+		return;
+
+	morse.append(0);
+	clearText.append(Morse::tokenSign(token));
+
+	if (!code.len) {
+		MYVERBOSE("  spc %d", wordSpacing);
+		morse.append(wordSpacing);
+		return;
 	}
-	return false;
+
+	quint16 bits = code.bits;
+	for (int i = 0; i < code.len; i++) {
+		if (i)
+			morse.append(intraSpacing);
+		morse.append(bits & 1 ? dahLength : ditLength);
+		bits >>= 1;
+	}
+	MYVERBOSE("  chr %d", charSpacing);
+	morse.append(charSpacing);
+}
+
+
+/*!
+ * \brief Add clear-text to morse storage
+ *
+ * @param str       clear text, e.g. "73 de dh3hs". \a str can be a single
+ *                  character, or it can be a character sequence. In all
+ *                  cases should it be lower-case! \n
+ *                  Use upper-case only to add morse pro-signs. Currently
+ *                  the program understands
+ *                  - AR: Stop (end of message)
+ *                  - AS: Wait (for 10 seconds)
+ *                  - BK: Break
+ *                  - BT: Separator within message
+ *                  - CL: Going off the air
+ *                  - CT: Start (beginning of message)
+ *                  - DO: Shift to japanese wabun code
+ *                  - HH: Error
+ *                  - KA: same as CT
+ *                  - KN: Invitation to a specific named station to transmit
+ *                  - SK: End (end of contact)
+ *                  - SN: Understood
+ *                  - SO: SOS without word spacings
+ *                  - TV: same as BT
+ *                  - VA: sama as SK
+ *                  - VE: same as SN
+ * @param addSpace  optional flag that tells us if a space (as a means to
+ *                  delimit words) should be added. This flag is by default
+ *                  on, you'd want to set it to falls if you characters
+ *                  one-by-one, e.g. when directly feeding typed characters
+ *                  into the class. A \a str that is just one sign, e.g.
+ *                  "p" or "AR", never gets a space.
+ *
+ * Characters without morse code are skipped with a warning.
+ *
+ * \sa appendText, appendMorse
+ */
+void GenerateMorse::append(const QString &str, bool addSpace)
+{
+	MYTRACE("GenerateMorse::append('%s')", qPrintable(str) );
+
+	// A single sign, e.g. a pro-sign, doesn't end a word
+	int token = codes.findToken(str.constData(), str.size());
+	if (token >= 0) {
+		appendToken(token);
+		return;
+	}
+
+	const QChar *text = str.constData();
+	int len = str.size();
+	while (len) {
+		int n = appendText(text, len, ReportUnknown);
+		if (n == len)
+			break;
+		qWarning("no morse code for '%s' known", qPrintable(QString(text[n])));
+		text += n + 1;
+		len -= n + 1;
+	}
+	if (addSpace)
+		appendToken(Morse::spaceToken());
+}
+
+
+/*!
+ * \brief Tokenize and add text to \ref tokens, see \ref appendText()
+ *
+ * This is a template so that we can encode QString data and plain Latin-1
+ * bytes (e.g. from a memory-mapped file) alike, without converting
+ * anything first.
+ */
+template <typename C>
+int GenerateMorse::encode(const C *text, int len, UnknownPolicy policy)
+{
+	tokens.reserve(tokens.size() + len);
+
+	const int space = Morse::spaceToken();
+	int lastToken = tokens.isEmpty() ? -1 : (uchar)tokens.at(tokens.size() - 1);
+
+	for (int i = 0; i < len; i++) {
+		// Any run of white space is one word space
+		if (QChar(unit(text[i])).isSpace()) {
+			if (lastToken != space)
+				appendToken(lastToken = space);
+			continue;
+		}
+
+		int n;
+		int token = codes.matchToken(text + i, len - i, &n);
+		if (token < 0) {
+			MYVERBOSE("  unknown character at %d", i);
+			if (policy == ReportUnknown)
+				return i;
+			if (policy == SubstituteUnknown)
+				token = substToken;
+			if (token < 0)
+				continue;
+		}
+		appendToken(lastToken = token);
+		i += n - 1;
+	}
+	return len;
+}
+
+
+/*!
+ * \brief Add a whole text to morse storage
+ *
+ * This is the fast way to queue long texts: it goes over the text in one
+ * pass, and unlike \ref append() it doesn't create strings for the
+ * characters. Together with \ref setCompact() nothing at all get's
+ * allocated per character (unless \ref Morse::setOverlay() is on).
+ *
+ * Any white space (also line breaks) becomes one word space. Upper-case
+ * characters are first tried as pro-signs, then as normal characters.
+ *
+ * @param text    clear text
+ * @param len     number of characters in \a text
+ * @param policy  what to do with characters that have no morse code
+ * @returns       number of characters consumed. This is \a len, unless
+ *                \a policy is \ref ReportUnknown and an unknown character
+ *                has been found, then it's the position of this character.
+ */
+int GenerateMorse::appendText(const QChar *text, int len, UnknownPolicy policy)
+{
+	MYTRACE("GenerateMorse::appendText(%d chars)", len);
+
+	return encode(text, len, policy);
+}
+
+
+/*!
+ * \brief Add a Latin-1 encoded text to morse storage
+ *
+ * \sa appendText(const QChar *, int, UnknownPolicy)
+ */
+int GenerateMorse::appendText(const QByteArray &text, UnknownPolicy policy)
+{
+	MYTRACE("GenerateMorse::appendText(%d bytes)", text.size());
+
+	return encode(text.constData(), text.size(), policy);
+}
+
+
+/*!
+ * \brief Add the contents of a Latin-1 encoded text file to morse storage
+ *
+ * The file get's memory-mapped, so it's contents isn't copied.
+ *
+ * @returns false if the file can't be read, is 2 GB or larger, or if \a
+ *          policy is \ref ReportUnknown and the file contains unknown
+ *          characters.
+ *
+ * \sa appendText(const QChar *, int, UnknownPolicy)
+ */
+bool GenerateMorse::appendFile(const QString &fname, UnknownPolicy policy)
+{
+	MYTRACE("GenerateMorse::appendFile(%s)", qPrintable(fname));
+
+	QFile f(fname);
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+	qint64 size = f.size();
+	if (!size)
+		return true;
+	if (size > INT_MAX) {
+		qWarning("%s is too large", qPrintable(fname));
+		return false;
+	}
+
+	const char *data = (const char *)f.map(0, size);
+	if (!data) {
+		QByteArray all = f.readAll();
+		return appendText(all, policy) == all.size();
+	}
+
+	bool ok = encode(data, (int)size, policy) == (int)size;
+	f.unmap((uchar *)data);
+	return ok;
+}
+
+
+/*!
+ * \brief Set what \ref SubstituteUnknown adds for unknown characters
+ *
+ * @param clearText  a character with morse code, "?" by default. If it
+ *                   has no morse code, unknown characters get skipped.
+ */
+void GenerateMorse::setSubstitute(const QString &clearText)
+{
+	substToken = codes.findToken(clearText.constData(), clearText.size());
+}
+
+
+/*!
+ * \brief Clear the morse storage
+ *
+ * Clears \ref tokens, \ref morse, \ref clearText and resets the replay
+ * indexes \ref playIdx and \ref clearIdx.
+ */
+void GenerateMorse::clear()
+{
+	MYTRACE("GenerateMorse::clear");
+
+	QMutexLocker lock(&playMutex);
+
+	tokens.clear();
+	total = MorseCount();
+	checkpoints.clear();
+	tailStop = false;
+	morse.clear();
+	clearText.clear();
+	playElement = 0;
+	playIdx = 0;
+	clearIdx = 0;
+	playToken = 0;
+	playSub = 0;
+	played = MorseCount();
+	emit currElement(playElement);
+}
+
+
+/*!
+ * \brief Switch between normal and compact storage
+ *
+ * Normally every character is stored as it's clear text in \ref clearText
+ * and as it's expanded elements in \ref morse. That costs more than 100
+ * bytes per character. In compact mode only \ref tokens is kept, one byte
+ * per character, and the elements get expanded while playing. Use this when
+ * you queue long texts.
+ *
+ * Don't switch while playing.
+ */
+void GenerateMorse::setCompact(bool on)
+{
+	MYTRACE("GenerateMorse::setCompact(%d)", on);
+
+	if (on == compact)
+		return;
+	compact = on;
+
+	morse.clear();
+	clearText.clear();
+	if (compact)
+		return;
+
+	// Rebuild the expanded form
+	QByteArray t = tokens;
+	bool stop = tailStop;
+	tokens.clear();
+	total = MorseCount();
+	checkpoints.clear();
+	foreach(char token, t)
+		appendToken((uchar)token);
+	setTailStop(stop);
 }
 
-const QString Morse::operator[] (const QString &clearText) const
+
+/*!
+ * \brief Remove word spaces from the end of the storage
+ */
+void GenerateMorse::stripSpaces()
 {
-	MYTRACE("Morse::operator[](%s)", qPrintable(clearText));
-	foreach(MorseCharacter m, chars) {
-		if (m.sign == clearText)
-			return m.code;
+	while (!tokens.isEmpty()) {
+		MorseCode code = Morse::tokenCode((uchar)tokens.at(tokens.size() - 1));
+		if (code.len)
+			break;
+		tokens.chop(1);
+		total.subtract(code);
+		if (!(tokens.size() % checkpointDistance))
+			checkpoints.removeLast();
+		if (!compact) {
+			morse.removeLast();
+			morse.removeLast();
+			clearText.removeLast();
+		}
 	}
-	return QString::null;
 }
 
 
 /*!
- * \brief Class to generate morse code
+ * \brief Sets \ref tailStop
  *
- * Simple usage:
- * \code
- *   GenerateMorse *morse = new GenerateMorse(this);
- *   connect(morse, SIGNAL(playSound(int)), audio, SLOT(playSound(int)) );
- *   morse->append("73 de");
- *   morse->append("dh3hs");
- *   morse->play();
- * \endcode
+ * In normal mode this also modifies the last element of \ref morse.
  */
-GenerateMorse::GenerateMorse(QObject *parent)
-	: QObject(parent)
-	, playElement(0)
-	, playIdx(0)
-	, clearIdx(0)
-	, playLoop(false)
-	, playWpm(5)
-	, ditFactor(1)
-	, dahFactor(1)
-	, intraFactor(1)
-	, charFactor(1)
-	, wordFactor(1)
+void GenerateMorse::setTailStop(bool on)
 {
-	MYTRACE("GenerateMorse::GenerateMorse");
+	if (on == tailStop)
+		return;
+	if (on && tokens.isEmpty())
+		return;
+	tailStop = on;
+	if (!compact)
+		morse.last() = on ? intraSpacing : charSpacing;
+}
 
-	playTimer = new QTimer(this);
-	playTimer->setSingleShot(true);
-	connect(playTimer, SIGNAL(timeout()), this, SLOT(slotPlayNext()) );
+
+/*!
+ * \brief Return the elements of the morse storage
+ *
+ * That's \ref morse, or in compact mode the same expanded from \ref
+ * tokens.
+ */
+QList<int> GenerateMorse::elements() const
+{
+	if (!compact)
+		return morse;
+
+	QList<int> list;
+	list.reserve(total.elements);
+	for (int i = 0; i < tokens.size(); i++) {
+		MorseCode code = Morse::tokenCode((uchar)tokens.at(i));
+		int n = codeElements(code);
+		for (int j = 0; j < n; j++)
+			list.append(codeElement(code, j));
+	}
+	if (tailStop)
+		list.last() = intraSpacing;
+	return list;
 }
 
 
-/*
- * Section: adding morse characters and cleartext
+/*!
+ * \brief Duration of one element like in \ref morse
  */
+qint64 MorseTiming::element(int elem) const
+{
+	switch (elem) {
+	case ditLength: return dit;
+	case dahLength: return dah;
+	case intraSpacing: return intra;
+	case charSpacing: return chr;
+	case wordSpacing: return word;
+	}
+	return 0;
+}
 
-/* NOTE: all values must be different ! */
-const int ditLength = 1;
-const int dahLength = 3;
-const int intraSpacing = -1;
-const int charSpacing = -3;
-const int wordSpacing = -7;
 
 /*!
- * \brief Add morse code (in string representation) to morse storage
- *
- * The string representation will be converted into lengths of dits and
- * dahs, but also into spacings (intra-character spacing, between character
- * spacing, word spacing) and then added to \ref morse. The cleartext is also
- * added to \ref clearText.
- *
- * @param dahdits  string representation of morse, e.g. "-."
- * @param clear    clear-text of the same
- *
- * \sa append
+ * \brief Duration of all the elements in \a c
  */
-void GenerateMorse::appendMorse(const QString &dahdits, const QString &clear)
+qint64 MorseTiming::duration(const MorseCount &c) const
 {
-	MYTRACE("GenerateMorse::appendMorse('%s', '%s')",
-	        qPrintable(dahdits), qPrintable(clear) );
+	return c.dits * dit
+		+ c.dahs * dah
+		+ c.intras * intra
+		+ c.chars * chr
+		+ c.words * word;
+}
 
-	int last = 0;
 
-	morse.append(0);
-	clearText.append(clear);
+/*!
+ * \brief Counts of the first \a n tokens
+ *
+ * Starts at the nearest checkpoint, so this looks at no more than \ref
+ * checkpointDistance tokens.
+ */
+MorseCount GenerateMorse::countTokens(int n) const
+{
+	int cp = n / checkpointDistance;
+	if (cp >= checkpoints.size())
+		cp = checkpoints.size() - 1;
+	if (cp < 0)
+		return MorseCount();
+
+	MorseCount c = checkpoints.at(cp);
+	for (int i = cp * checkpointDistance; i < n; i++)
+		c.add(Morse::tokenCode((uchar)tokens.at(i)));
+	if (tailStop && n == tokens.size()) {
+		c.chars--;
+		c.intras++;
+	}
+	return c;
+}
 
-	for (int i = 0; i < dahdits.size(); ++i) {
-		char c = dahdits.at(i).toAscii();
 
-		if (!morse.isEmpty()) {
-			last = morse.last();
-			//MYVERBOSE("last %d", last);
-		}
+/*!
+ * \brief Counts of the first \a n elements
+ *
+ * Finds the right checkpoint with a binary search, then goes over the
+ * tokens from there.
+ */
+MorseCount GenerateMorse::countElements(int n) const
+{
+	if (n >= total.elements)
+		return countTokens(tokens.size());
+
+	int lo = 0;
+	int hi = checkpoints.size() - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (checkpoints.at(mid).elements <= n)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
 
-		MYVERBOSE("  append '%c'", c);
-		switch (c) {
-		case '.':
-			if (last > 0) {
-				MYVERBOSE("  DIT %d", intraSpacing);
-				morse.append(intraSpacing);
-			}
-			MYVERBOSE("  dit %d, last %d", ditLength, last);
-			morse.append(ditLength);
-			break;
-		case '-':
-			if (last > 0) {
-				MYVERBOSE("  DAH %d", intraSpacing);
-				morse.append(intraSpacing);
-			}
-			MYVERBOSE("  dah %d, last %d", dahLength, last);
-			morse.append(dahLength);
-			break;
-		case ' ':
-			if (last == charSpacing) {
-				MYVERBOSE("  spc %d, last %d (promoted from charSpacing)", wordSpacing, last);
-				morse.last() = wordSpacing;
-			} else {
-				MYVERBOSE("  spc %d, last %d", wordSpacing, last);
-				morse.append(wordSpacing);
-			}
+	MorseCount c = lo < checkpoints.size() ? checkpoints.at(lo) : MorseCount();
+	for (int i = lo * checkpointDistance; i < tokens.size(); i++) {
+		MorseCode code = Morse::tokenCode((uchar)tokens.at(i));
+		int len = codeElements(code);
+		if (c.elements + len > n) {
+			for (int j = 0; c.elements < n; j++)
+				c.addElement(codeElement(code, j));
 			break;
 		}
+		c.add(code);
 	}
-	if (!morse.isEmpty())
-		last = morse.last();
-	if (last != wordSpacing) {
-		MYVERBOSE("  chr %d, last %d", charSpacing, last);
-		morse.append(charSpacing);
-	}
+	return c;
 }
 
 
 /*!
- * \brief Add clear-text to morse storage
+ * \brief Duration in ms of the elements in \a c at the current speed
  *
- * @param str       clear text, e.g. "73 de dh3hs". \a str can be a single
- *                  character, or it can be a character sequence. In all
- *                  cases should it be lower-case! \n
- *                  Use upper-case only to add morse pro-signs. Currently
- *                  the program understands
- *                  - AR: Stop (end of message)
- *                  - AS: Wait (for 10 seconds)
- *                  - BK: Break
- *                  - BT: Separator within message
- *                  - CL: Going off the air
- *                  - CT: Start (beginning of message)
- *                  - DO: Shift to japanese wabun code
- *                  - HH: Error
- *                  - KA: same as CT
- *                  - KN: Invitation to a specific named station to transmit
- *                  - SK: End (end of contact)
- *                  - SN: Understood
- *                  - SO: SOS without word spacings
- *                  - TV: same as BT
- *                  - VA: sama as SK
- *                  - VE: same as SN
- * @param addSpace  optional flag that tells us if a space (as a means to
- *                  delimit words) should be added. This flag is by default
- *                  on, you'd want to set it to falls if you characters
- *                  one-by-one, e.g. when directly feeding typed characters
- *                  into the class.
+ * \sa slotPlayNext()
+ */
+int GenerateMorse::durationMs(const MorseCount &c) const
+{
+	return (int)((timing().duration(c) + 500000) / 1000000);
+}
+
+
+/*!
+ * \brief Durations of the elements at the current speed
  *
- * \sa appendMorse
+ * They get calculated again only after \ref setWpm() or one of the \c
+ * setXFactor() functions has been called.
  */
-void GenerateMorse::append(const QString &str, bool addSpace)
+const MorseTiming &GenerateMorse::timing() const
 {
-	MYTRACE("GenerateMorse::append('%s')", qPrintable(str) );
+	QMutexLocker lock(&playMutex);
+	if (timingValid)
+		return playTiming;
 
-	if (codes.contains(str)) {
-		appendMorse(codes[str], str);
-		return;
-	}
+	// http://forums.qrz.com/showthread.php?t=178795
 
-	for (int i=0; i<str.count(); i++) {
-		QString c = str.mid(i,1);
-		MYVERBOSE("processing '%s'", qPrintable(c));
-		if (c.at(0).isUpper()) { // && i < str.count()-1) {
-			c = str.mid(i,2);
-			MYVERBOSE("  special '%s'", qPrintable(c));
-			i++;
-		}
-		if (codes.contains(c)) {
-			appendMorse(codes[c], c);
-		} else {
-			qFatal("no morse code for '%s' known", qPrintable(c));
-		}
-	}
-	if (addSpace)
-		appendMorse(" ", " ");
+	// paris = 50 elements -> 1 word per minuts = 50 elements per minute
+	//
+	//        60s / wpm * 50 elements = x  s/element
+	// 1000 * 60s / wpm * 50 elements = x ms/element
+	//     60000s / wpm * 50 elements = x ms/element
+	//      1200  / wpm               = x ms/element
+
+	double ns = 1200000000.0 / playWpm;
+	playTiming.dit = qRound64(ns * ditLength * ditFactor);
+	playTiming.dah = qRound64(ns * dahLength * dahFactor);
+	playTiming.intra = qRound64(ns * -intraSpacing * intraFactor);
+	playTiming.chr = qRound64(ns * -charSpacing * charFactor);
+	playTiming.word = qRound64(ns * -wordSpacing * wordFactor);
+	timingValid = true;
+	MYVERBOSE("timing: dit %lld, dah %lld, intra %lld, char %lld, word %lld ns",
+	          playTiming.dit, playTiming.dah, playTiming.intra,
+	          playTiming.chr, playTiming.word);
+	return playTiming;
 }
 
 
 /*!
- * \brief Clear the morse storage
+ * \brief Time in ns where a character starts, at the current speed
  *
- * Clears \ref morse, \ref clearText and resets the replay indexes \ref playIdx
- * and \ref clearIdx.
+ * This is the same schedule that \ref slotPlayNext() follows, so audio or
+ * display code can use it to place things exactly.
+ *
+ * @param charIndex  index into \ref tokens
  */
-void GenerateMorse::clear()
+qint64 GenerateMorse::startNs(int charIndex) const
 {
-	MYTRACE("GenerateMorse::clear");
+	return timing().duration(countTokens(qBound(0, charIndex, tokens.size())));
+}
 
-	morse.clear();
-	clearText.clear();
-	playElement = 0;
-	playIdx = 0;
-	clearIdx = 0;
-	emit currElement(playElement);
+
+/*!
+ * \brief Time in ns where the element that plays next starts
+ *
+ * \sa startNs()
+ */
+qint64 GenerateMorse::positionNs() const
+{
+	return timing().duration(played);
 }
 
 
+/*!
+ * \brief Sum of the element lengths in \ref morse
+ *
+ * A dit counts 1, a dah 3 and so on, see \ref morse.
+ *
+ * @param from  first element to count, an index into \ref morse
+ */
 int GenerateMorse::totalElements(int from) const
 {
 	MYTRACE("GenerateMorse::totalElements");
 
-	int dits = 0;
-	int dahs = 0;
-	int intras = 0;
-	int chars = 0;
-	int words = 0;
-
-	int sum = 0;
-	for (int i=from; i < morse.count(); i++) {
-		int elem = morse.at(i);
-		switch (elem) {
-		case ditLength: dits++; break;
-		case dahLength: dahs++; break;
-		case intraSpacing: intras++; break;
-		case charSpacing: chars++; break;
-		case wordSpacing: words++; break;
-		}
-		//MYVERBOSE("%d: %d", i, elem );
-		sum += qAbs(elem);
+	MorseCount all = countTokens(tokens.size());
+	if (from <= 0)
+		return all.units();
+	return all.units() - countElements(from).units();
+}
+
+
+/*!
+ * \brief Duration of the whole text in ms, at the current speed
+ */
+int GenerateMorse::totalMs() const
+{
+	return durationMs(countTokens(tokens.size()));
+}
+
+
+/*!
+ * \brief Duration in ms of what hasn't been played yet
+ */
+int GenerateMorse::remainingMs() const
+{
+	MorseCount c = countTokens(tokens.size());
+	c.dits -= played.dits;
+	c.dahs -= played.dahs;
+	c.intras -= played.intras;
+	c.chars -= played.chars;
+	c.words -= played.words;
+	return durationMs(c);
+}
+
+
+/*!
+ * \brief Set the play position to the start of character \a charIndex
+ *
+ * The caller holds \ref playMutex.
+ */
+void GenerateMorse::moveTo(int charIndex)
+{
+	charIndex = qBound(0, charIndex, tokens.size());
+	played = countTokens(charIndex);
+	playToken = charIndex;
+	playSub = 0;
+	clearIdx = charIndex;
+	playIdx = played.elements;
+	playElement = played.units();
+}
+
+
+/*!
+ * \brief Continue playing at a character
+ *
+ * If we're currently playing, the sound get's turned off and playing goes
+ * on from there at once. Otherwise the next \ref play() starts there.
+ *
+ * @param charIndex  index into \ref tokens, that is the number of clear
+ *                   text characters (including word spaces) to skip
+ * @returns          the new \ref position()
+ */
+int GenerateMorse::seek(int charIndex)
+{
+	MYTRACE("GenerateMorse::seek(%d)", charIndex);
+
+	// The scheduler locks playMutex itself, so stop it before
+	bool playing = scheduler ? scheduler->isRunning() : playTimer->isActive();
+	if (scheduler)
+		scheduler->halt();
+
+	QMutexLocker lock(&playMutex);
+
+	moveTo(charIndex);
+	emit currElement(playElement);
+	playClock.start();
+	playNs = 0;
+
+	if (playing) {
+		emit playSound(false);
+		if (scheduler)
+			scheduler->start(QThread::TimeCriticalPriority);
+		else
+			playTimer->start(0);
+	}
+	return playToken;
+}
+
+
+/*!
+ * \brief Continue playing at the character that plays at \a ms
+ *
+ * @param ms  time since the start of the text, at the current speed
+ * @returns   the new \ref position()
+ *
+ * \sa seek()
+ */
+int GenerateMorse::seekMs(int ms)
+{
+	MYTRACE("GenerateMorse::seekMs(%d)", ms);
+
+	// Last checkpoint that starts at or before ms
+	int lo = 0;
+	int hi = checkpoints.size() - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (durationMs(checkpoints.at(mid)) <= ms)
+			lo = mid;
+		else
+			hi = mid - 1;
 	}
-	MYVERBOSE("  elements %d, dits %d, dahs %d, intras %d, chars %d, words %d",
-	          sum, dits, dahs, intras, chars, words);
-	return sum;
+
+	MorseCount c = lo < checkpoints.size() ? checkpoints.at(lo) : MorseCount();
+	int i = lo * checkpointDistance;
+	for (; i < tokens.size() - 1; i++) {
+		MorseCount next = c;
+		next.add(Morse::tokenCode((uchar)tokens.at(i)));
+		if (durationMs(next) > ms)
+			break;
+		c = next;
+	}
+	return seek(i);
 }
 
 
@@ -293,6 +1489,10 @@ int GenerateMorse::totalElements(int from) const
  *
  * Internally \ref playTimer get's started and whenever something has to be
  * done, one of the signals are emitted. This happens in \ref slotPlayNext().
+ * With \ref setRealtime() the \ref scheduler thread does the same instead.
+ *
+ * Playing starts at \ref position(), which \ref seek() can move. After
+ * the end of the text or \ref stop() that's the start of the text again.
  *
  * \sa stop(), slotPlayNext(), setLoop()
  */
@@ -301,37 +1501,46 @@ void GenerateMorse::play()
 {
 	MYTRACE("GenerateMorse::play");
 
+	if (scheduler)
+		scheduler->halt();
+
 	if (!playLoop) {
 		// Remove all trailing silence. Note that we don't do this
 		// in loop mode, otherwise we'd jam the end of the text to
-		// the start of the text with no pause at all.
-		while (!morse.isEmpty() && morse.last() < 0)
-			morse.removeLast();
-		while (!clearText.isEmpty() && clearText.last().isEmpty())
-			clearText.removeLast();
+		// the start of the text with no pause at all. Only one
+		// small silence stays, to stop the sound.
+		stripSpaces();
+		setTailStop(true);
 	}
 
 	emit maxElements(totalElements());
 
 	// Nothing left?  Bail out!
-	if (morse.isEmpty()) {
+	if (tokens.isEmpty()) {
 		emit hasStopped();
 		return;
 	}
 
-	// One one small silence back, to stop the sound
-	morse.append(intraSpacing);
+	QMutexLocker lock(&playMutex);
 
-	playElement = 0;
-	playIdx = 0;
-	clearIdx = 0;
-	playTimer->start(0);
+	// Go on where seek() left us, but start over after the end
+	moveTo(playToken < tokens.size() ? playToken : 0);
+	emit currElement(playElement);
+	playClock.start();
+	playNs = 0;
+	if (scheduler)
+		scheduler->start(QThread::TimeCriticalPriority);
+	else
+		playTimer->start(0);
 }
 
 
 /*!
  * \brief Stop playing morse
  *
+ * The next \ref play() starts at the beginning, unless there's a \ref
+ * seek() in between.
+ *
  * \sa start()
  */
 void GenerateMorse::stop()
@@ -339,15 +1548,58 @@ void GenerateMorse::stop()
 	MYTRACE("GenerateMorse::stop");
 
 	playTimer->stop();
+	if (scheduler)
+		scheduler->halt();
+
+	QMutexLocker lock(&playMutex);
+	moveTo(0);
+}
+
+
+/*!
+ * \brief Play from a \ref MorseScheduler thread instead of a QTimer
+ *
+ * Use this when you key a transmitter or need the element timing better
+ * than a millisecond. Don't modify the morse storage while playing then.
+ *
+ * @param on    use the thread
+ * @param fifo  try to get real-time priority (SCHED_FIFO) for it
+ *
+ * \sa jitter()
+ */
+void GenerateMorse::setRealtime(bool on, bool fifo)
+{
+	MYTRACE("GenerateMorse::setRealtime(%d, %d)", on, fifo);
+
+	stop();
+	delete scheduler;
+	scheduler = 0;
+	if (on) {
+		scheduler = new MorseScheduler(this);
+		scheduler->setFifo(fifo);
+	}
+}
+
+
+/*!
+ * \brief How late the \ref scheduler keyed the elements
+ *
+ * Empty if \ref setRealtime() isn't on.
+ */
+MorseJitter GenerateMorse::jitter() const
+{
+	return scheduler ? scheduler->jitter() : MorseJitter();
 }
 
 
 /*!
  * \brief Handle next morse event
  *
- * Called from \ref playTimer. \ref playIdx is used to step throught \ref morse
+ * Called from \ref slotPlayNext() or from the \ref scheduler thread.
+ * \ref playIdx is used to step throught \ref morse
  * and \ref clearIdx is used to step throught \ref clearText. The contents of
- * both lists are then used to emit various signals.
+ * both lists are then used to emit various signals. In compact mode, the
+ * same elements get expanded from \ref tokens instead.
  *
  * Any class (or classes) receiving those signals can then generate sound
  * or controll the PTT of your rig and similar things.
@@ -355,36 +1607,60 @@ void GenerateMorse::stop()
  * As \ref morse contains times in "elements" units, the actual timing
  * is controlled by \ref setWpm() and the other \c setXFactor() functions.
  *
+ * @returns duration of the element in ns, or -1 when we're done
+ *
  * \sa play(), playSound(bool), playSound(unsigned int), hasStopped(),
  * charChanged() symbolChanged()
  */
-void GenerateMorse::slotPlayNext()
+qint64 GenerateMorse::playNext()
 {
-	MYTRACE("GenerateMorse::slotPlayNext");
+	MYTRACE("GenerateMorse::playNext");
+
+	QMutexLocker lock(&playMutex);
 
-	MYVERBOSE("playIdx %d, count %d", playIdx, morse.count());
-	if (playIdx >= morse.count() ) {
+	MYVERBOSE("playIdx %d, count %d", playIdx, total.elements);
+	if (playIdx >= total.elements) {
 		if (playLoop) {
 			playElement = 0;
 			playIdx = 0;
 			clearIdx = 0;
+			playToken = 0;
+			playSub = 0;
+			played = MorseCount();
 			emit currElement(0);
 		} else {
 			emit hasStopped();
-			return;
+			return -1;
 		}
 	}
 
-	int t = morse[playIdx];
+	// Also in normal mode we step through the tokens, to know the
+	// position for seek() and remainingMs()
+	int t;
+	MorseCode code = Morse::tokenCode((uchar)tokens.at(playToken));
+	if (compact) {
+		// Expand the elements from the tokens
+		t = codeElement(code, playSub);
+		if (t == charSpacing && tailStop && playToken == tokens.size() - 1)
+			t = intraSpacing;
+	} else {
+		t = morse[playIdx];
+	}
+	if (++playSub == codeElements(code)) {
+		playSub = 0;
+		playToken++;
+	}
 	MYVERBOSE("playIdx %d, play %d", playIdx, t);
+	played.addElement(t);
 	playElement += qAbs(t);
 	emit currElement(playElement);
 
-	float factor = 1;
 	switch (t) {
 	case 0:
 		{
-			QString clear = clearText[clearIdx++];
+			const QString &clear = compact
+				? Morse::tokenSign((uchar)tokens.at(clearIdx++))
+				: clearText[clearIdx++];
 			MYVERBOSE("  cleartext '%s'", qPrintable(clear));
 			emit charChanged(clear);
 		}
@@ -392,53 +1668,61 @@ void GenerateMorse::slotPlayNext()
 	case ditLength:
 		emit symbolChanged(".");
 		emit playSound(true);
-		factor = ditFactor;
 		break;
 	case dahLength:
 		emit symbolChanged("-");
 		emit playSound(true);
-		factor = dahFactor;
 		break;
 	case intraSpacing:
 		emit symbolChanged(" ");
 		emit playSound(false);
-		factor = intraFactor;
 		break;
 	case charSpacing:
 		emit charChanged(" ");
 		emit symbolChanged(" ");
 		emit playSound(false);
-		factor = charFactor;
 		break;
 	case wordSpacing:
 		emit charChanged(" ");
 		emit symbolChanged(" ");
 		emit playSound(false);
-		factor = wordFactor;
 		break;
 	}
 
 	playIdx++;
 
+	qint64 length = timing().element(t);
+	if (t > 0)
+		emit playSound((unsigned int)((length + 500000) / 1000000));
+	return length;
+}
 
-	// http://forums.qrz.com/showthread.php?t=178795
-
-	// paris = 50 elements -> 1 word per minuts = 50 elements per minute
-	//
-	//        60s / wpm * 50 elements = x  s/element
-	// 1000 * 60s / wpm * 50 elements = x ms/element
-	//     60000s / wpm * 50 elements = x ms/element
-	//      1200  / wpm               = x ms/element
-
-	float length = 1200 / playWpm;
-	//MYVERBOSE("elem length: %f ms", length);
-	length *= qAbs(t) * factor;
 
-	if (t > 0)
-		emit playSound((unsigned int)length);
+/*!
+ * \brief Play the next element, called from \ref playTimer
+ *
+ * The deadlines are absolute, so a timer that fires late makes the next
+ * element shorter, and nothing adds up over a long text.
+ */
+void GenerateMorse::slotPlayNext()
+{
+	MYTRACE("GenerateMorse::slotPlayNext");
 
-	//MYVERBOSE("delay: %f ms", length);
-	playTimer->start(length);
+	qint64 length = playNext();
+	if (length < 0)
+		return;
+	playNs += length;
+
+	qint64 wait = playNs - playClock.nsecsElapsed();
+	if (wait < -MorseScheduler::maxLateNs) {
+		// We were stopped for too long, e.g. by a suspend. Don't try
+		// to catch up, this would just rush through the text.
+		MYVERBOSE("late by %lld ns, resync", -wait);
+		playNs -= wait;
+		wait = 0;
+	}
+	//MYVERBOSE("delay: %lld ns", wait);
+	playTimer->start(wait > 0 ? (int)((wait + 999999) / 1000000) : 0);
 }
 
 
@@ -484,12 +1768,10 @@ void GenerateMorse::setLoop(bool loop)
 {
 	// First make sure that we have a pause at the end if we're in loop
 	// mode, but no pause if not.
-	while (!morse.isEmpty() && morse.last() < 0)
-		morse.removeLast();
-	while (!clearText.isEmpty() && clearText.last().isEmpty())
-		clearText.removeLast();
+	setTailStop(false);
+	stripSpaces();
 	if (loop)
-		append(" ");
+		appendToken(Morse::spaceToken());
 
 	playLoop = loop;
 }
@@ -510,7 +1792,9 @@ void GenerateMorse::setLoop(bool loop)
  */
 void GenerateMorse::setWpm(float wpm)
 {
+	QMutexLocker lock(&playMutex);
 	playWpm = wpm;
+	timingValid = false;
 };
 
 
@@ -526,7 +1810,9 @@ void GenerateMorse::setWpm(float wpm)
  */
 void GenerateMorse::setDitFactor(float factor)
 {
+	QMutexLocker lock(&playMutex);
 	ditFactor = factor;
+	timingValid = false;
 };
 
 
@@ -535,7 +1821,9 @@ void GenerateMorse::setDitFactor(float factor)
  */
 void GenerateMorse::setDahFactor(float factor)
 {
+	QMutexLocker lock(&playMutex);
 	dahFactor = factor;
+	timingValid = false;
 };
 
 
@@ -549,7 +1837,9 @@ void GenerateMorse::setDahFactor(float factor)
  */
 void GenerateMorse::setIntraFactor(float factor)
 {
+	QMutexLocker lock(&playMutex);
 	intraFactor = factor;
+	timingValid = false;
 };
 
 
@@ -562,7 +1852,9 @@ void GenerateMorse::setIntraFactor(float factor)
  */
 void GenerateMorse::setCharFactor(float factor)
 {
+	QMutexLocker lock(&playMutex);
 	charFactor = factor;
+	timingValid = false;
 };
 
 
@@ -575,5 +1867,7 @@ void GenerateMorse::setCharFactor(float factor)
  */
 void GenerateMorse::setWordFactor(float factor)
 {
+	QMutexLocker lock(&playMutex);
 	wordFactor = factor;
+	timingValid = false;
 };
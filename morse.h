@@ -22,17 +22,119 @@
 
 #include <QObject>
 #include <QString>
+#include <QByteArray>
 #include <QHash>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QMutex>
+
+#include "morse_scheduler.h"
 
 
 class QTimer;
 
 
+/*!
+ * \brief Morse code of one character, packed into bits
+ *
+ * Element \c n of the code is stored in bit \c n of \ref bits, a 0 bit is a
+ * dit and a 1 bit is a dah. So ".-" is stored as bits 0x2 with len 2. A
+ * \ref len of 0 stands for the word space " ".
+ *
+ * This is what the table generated by \c morsetable.py contains, and what
+ * \ref GenerateMorse::appendMorse() expands into \ref GenerateMorse::morse.
+ */
+struct MorseCode {
+	quint16 bits; //!< \brief dit/dah pattern, first element in bit 0
+	quint8 len;   //!< \brief Number of dits and dahs, at most 16
+
+	static MorseCode fromString(const QString &dahdits);
+	QString toString() const;
+};
+
+
+/*!
+ * \brief One entry of the static character table
+ *
+ * The table itself is generated from \c characters.csv by \c morsetable.py
+ * at build time, see \ref Morse.
+ */
+struct MorseTableEntry {
+	char sign[5];   //!< \brief Clear text, e.g. "a" or the prosign "AR"
+	quint8 len;     //!< \brief Length of \ref sign
+	MorseCode code; //!< \brief Morse code
+};
+
+
+/*!
+ * \brief Translation from clear text to morse code
+ */
 class Morse {
 public:
 	//Morse();
 	bool contains(const QString &clearText) const;
 	const QString operator[] (const QString &clearText) const;
+	const MorseTableEntry *lookup(const QChar *clearText, int len) const;
+	bool find(const QChar *clearText, int len, MorseCode *code) const;
+	int findToken(const QChar *clearText, int len) const;
+	int matchToken(const QChar *text, int len, int *matched) const;
+	int matchToken(const char *text, int len, int *matched) const;
+
+	static void setOverlay(bool on);
+	static bool overlay();
+
+	static int token(const QString &clearText, const MorseCode &code);
+	static int spaceToken();
+	static MorseCode tokenCode(int token);
+	static const QString &tokenSign(int token);
+
+	/*! \brief Codes with more elements can't be decoded */
+	static const int treeDepth = 10;
+	/*! \brief Number of nodes in the decoding tree, see \ref treeToken() */
+	static const int treeSize = 2 << treeDepth;
+	static int treeToken(int node);
+};
+
+
+/*!
+ * \brief Number of elements of each kind in a part of the morse storage
+ *
+ * With these counts the duration of that part can be calculated for any
+ * speed, see \ref GenerateMorse::totalMs().
+ */
+struct MorseCount {
+	int elements; //!< \brief entries in \ref GenerateMorse::morse, incl. the 0's
+	int dits;     //!< \brief number of dits
+	int dahs;     //!< \brief number of dahs
+	int intras;   //!< \brief number of intra-character spacings
+	int chars;    //!< \brief number of character spacings
+	int words;    //!< \brief number of word spacings
+
+	MorseCount() : elements(0), dits(0), dahs(0), intras(0), chars(0), words(0) {}
+	void add(const MorseCode &code);
+	void subtract(const MorseCode &code);
+	void addElement(int elem);
+	int units() const;
+};
+
+
+/*!
+ * \brief Durations in nanoseconds of the element kinds
+ *
+ * These are integers, so adding them up gives exact times without any
+ * rounding error, no matter how long the text is.
+ *
+ * \sa GenerateMorse::timing()
+ */
+struct MorseTiming {
+	qint64 dit;    //!< \brief duration of a dit
+	qint64 dah;    //!< \brief duration of a dah
+	qint64 intra;  //!< \brief duration of an intra-character spacing
+	qint64 chr;    //!< \brief duration of a character spacing
+	qint64 word;   //!< \brief duration of a word spacing
+
+	qint64 element(int elem) const;
+	qint64 duration(const MorseCount &c) const;
 };
 
 
@@ -41,19 +143,100 @@ public:
  */
 class GenerateMorse : public QObject {
 	Q_OBJECT
+	friend class MorseScheduler;
 
 public:
 	GenerateMorse(QObject *parent=0);
+	~GenerateMorse();
+	/*! \brief What \ref appendText() does with characters without morse code */
+	enum UnknownPolicy {
+		SkipUnknown,       //!< \brief ignore them
+		SubstituteUnknown, //!< \brief add \ref setSubstitute() instead
+		ReportUnknown      //!< \brief stop and return their position
+	};
 	/*! Checks if the morse code for \c clearText exists */
 	bool exists(const QString clearText) { return codes.contains(clearText); };
 	void append(const QString &s, bool addSpace=true);
+	int  appendText(const QChar *text, int len, UnknownPolicy policy=SkipUnknown);
+	int  appendText(const QByteArray &text, UnknownPolicy policy=SkipUnknown);
+	bool appendFile(const QString &fname, UnknownPolicy policy=SkipUnknown);
+	void setSubstitute(const QString &clearText);
 	void appendMorse(const QString &dahdits, const QString &clear);
-	int  totalElements(int from=0) const; //!< Total elements in \ref morse.
+	void appendMorse(const MorseCode &code, const QString &clear);
+	void appendToken(int token);
+	int  totalElements(int from=0) const;
+	int  totalMs() const;
+	int  remainingMs() const;
+	/*! \brief Index into \ref tokens of the character that plays next */
+	int  position() const { return playToken; }
+	int  seek(int charIndex);
+	int  seekMs(int ms);
+	const MorseTiming &timing() const;
+	qint64 startNs(int charIndex) const;
+	qint64 positionNs() const;
+	void setRealtime(bool on, bool fifo=false);
+	/*! \brief Does a \ref MorseScheduler play? \sa setRealtime() */
+	bool isRealtime() const { return scheduler != 0; }
+	MorseJitter jitter() const;
+	QList<int> elements() const;
+	void setCompact(bool on);
+	/*! \brief Is \ref morse and \ref clearText left empty? \sa setCompact() */
+	bool isCompact() const { return compact; }
 public slots:
 	void clear();
 	/*! \brief Set new text */
 	void setText(const QString &s) { clear(); append(s); };
 private:
+	/*!
+	 * \brief Token storage
+	 *
+	 * One byte per clear text character, as returned by \ref
+	 * Morse::token(). This is always filled. \ref morse and \ref clearText
+	 * are just the expanded form of it, which isn't kept in compact mode.
+	 *
+	 * \sa setCompact()
+	 */
+	QByteArray tokens;
+	/*!
+	 * \brief Counts of all \ref tokens
+	 *
+	 * \c total.elements is the number of elements the tokens expand to.
+	 * The counts don't take \ref tailStop into account.
+	 */
+	MorseCount total;
+	/*!
+	 * \brief Prefix sums of the counts
+	 *
+	 * Entry \c n contains the counts of the first \c n * \ref
+	 * checkpointDistance tokens, so that we never have to go over more
+	 * than that many tokens to find out where something is.
+	 */
+	QVector<MorseCount> checkpoints;
+	/*! \brief Distance in \ref tokens between \ref checkpoints */
+	static const int checkpointDistance = 64;
+	MorseCount countTokens(int n) const;
+	MorseCount countElements(int n) const;
+	int durationMs(const MorseCount &c) const;
+	/*!
+	 * \brief Compact mode?
+	 *
+	 * In compact mode only \ref tokens get stored, the elements get
+	 * expanded while playing.
+	 */
+	bool compact;
+	/*!
+	 * \brief Play the trailing character spacing as intra-character spacing?
+	 *
+	 * When not looping, \ref play() doesn't play the silence at the end of
+	 * the text, only a short silence to stop the sound.
+	 */
+	bool tailStop;
+	/*! \brief Token used by \ref SubstituteUnknown, or -1 */
+	int substToken;
+	template <typename C> int encode(const C *text, int len, UnknownPolicy policy);
+	void stripSpaces();
+	void setTailStop(bool on);
+	void moveTo(int charIndex);
 	/*!
 	 * \brief Morse storage
 	 *
@@ -109,6 +292,9 @@ signals:
 	/*! \brief Emitted whenever a new dit or dah get's morsed */
 	void symbolChanged(const QString &);
 	/*! \brief Emits how many duration elements are stored \ref morse.
+	 *
+	 * This is the sum of the lengths of all elements (a dah counts 3),
+	 * same as \ref totalElements().
 	 * Usage:
 	 * \code
 	 *    connect(morse, SIGNAL(maxElements(int), progressBar, SLOT(setMaximum(int)) );
@@ -129,6 +315,30 @@ private:
 	int playIdx;
 	/*! \brief Index into \ref clearText */
 	int clearIdx;
+	/*! \brief Index into \ref tokens */
+	int playToken;
+	/*! \brief Element index inside of \ref playToken */
+	int playSub;
+	/*! \brief Counts of what has been played, see \ref remainingMs() */
+	MorseCount played;
+	/*! \brief Started by \ref play() and \ref seek(), the time base of \ref playNs */
+	QElapsedTimer playClock;
+	/*! \brief When the element that plays now ends, relative to \ref playClock */
+	qint64 playNs;
+	/*! \brief Cached result of \ref timing() */
+	mutable MorseTiming playTiming;
+	/*! \brief Is \ref playTiming up to date? Reset by the setters. */
+	mutable bool timingValid;
+	/*!
+	 * \brief Protects the play state against \ref scheduler
+	 *
+	 * Recursive, so that slots connected directly to our signals can
+	 * call e.g. \ref seek().
+	 */
+	mutable QMutex playMutex;
+	/*! \brief Thread that plays instead of \ref playTimer, or 0 */
+	MorseScheduler *scheduler;
+	qint64 playNext();
 	/*! \brief Timer for \ref play(), used to call \ref slotPlayNext() */
 	QTimer *playTimer;
 	/*! \brief Should \ref play() loop?  \sa setLoop() */
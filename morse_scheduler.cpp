@@ -0,0 +1,207 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ *
+ * @section DESCRIPTION
+ *
+ * Dedicated thread to play morse with exact element timing.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include "morse_scheduler.h"
+#include "morse.h"
+
+#include <QMutexLocker>
+
+#include <math.h>
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MAC)
+#define HAVE_CLOCK_NANOSLEEP
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+/*!
+ * \brief Never sleep longer than this, so that \ref MorseScheduler::halt()
+ * doesn't have to wait for a long word spacing
+ */
+static const qint64 maxSleepNs = 50000000;
+
+
+void MorseJitter::add(qint64 ns)
+{
+	count++;
+	sumNs += ns;
+	sumSq += (double)ns * ns;
+	if (ns > maxNs)
+		maxNs = ns;
+}
+
+
+double MorseJitter::meanNs() const
+{
+	return count ? (double)sumNs / count : 0;
+}
+
+
+double MorseJitter::stddevNs() const
+{
+	if (!count)
+		return 0;
+	double mean = meanNs();
+	double var = sumSq / count - mean * mean;
+	return var > 0 ? sqrt(var) : 0;
+}
+
+
+/*!
+ * \brief Monotonic time in ns
+ */
+qint64 MorseScheduler::now() const
+{
+#ifdef HAVE_CLOCK_NANOSLEEP
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (qint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return clock.nsecsElapsed();
+#endif
+}
+
+
+MorseScheduler::MorseScheduler(GenerateMorse *_gen)
+	: QThread(_gen)
+	, gen(_gen)
+	, fifo(false)
+	, halted(0)
+{
+	MYTRACE("MorseScheduler::MorseScheduler");
+	clock.start();
+}
+
+
+MorseScheduler::~MorseScheduler()
+{
+	halt();
+}
+
+
+/*!
+ * \brief Stop playing and wait until the thread has ended
+ */
+void MorseScheduler::halt()
+{
+	MYTRACE("MorseScheduler::halt");
+
+	halted = 1;
+	wait();
+	halted = 0;
+}
+
+
+/*!
+ * \brief Statistics of how late the elements got keyed
+ *
+ * Covers the current or the last run.
+ */
+MorseJitter MorseScheduler::jitter() const
+{
+	QMutexLocker lock(&statsMutex);
+	return stats;
+}
+
+
+/*!
+ * \brief Sleep until \a deadline, as returned by now()
+ */
+void MorseScheduler::sleepUntil(qint64 deadline)
+{
+	qint64 t;
+	while (!halted && (t = now()) < deadline) {
+		if (deadline - t > maxSleepNs)
+			t += maxSleepNs;
+		else
+			t = deadline;
+#ifdef HAVE_CLOCK_NANOSLEEP
+		struct timespec ts;
+		ts.tv_sec = t / 1000000000;
+		ts.tv_nsec = t % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+			;
+#else
+		qint64 us = (t - now() + 999) / 1000;
+		if (us > 0)
+			QThread::usleep(us);
+#endif
+	}
+}
+
+
+/*!
+ * \brief Play all elements
+ *
+ * The deadlines are absolute, so being late for one element doesn't
+ * delay the following ones.
+ */
+void MorseScheduler::run()
+{
+	MYTRACE("MorseScheduler::run");
+
+#ifdef HAVE_CLOCK_NANOSLEEP
+	if (fifo) {
+		struct sched_param param;
+		param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err)
+			qWarning("can't use SCHED_FIFO for keying, error %d", err);
+	}
+#endif
+
+	{
+		QMutexLocker lock(&statsMutex);
+		stats = MorseJitter();
+	}
+
+	qint64 deadline = now();
+	qint64 length = 0;
+	while (!halted) {
+		// Zero-length elements (the clear text) share the deadline
+		// with the next one, so only look after a real sleep
+		if (length) {
+			qint64 late = now() - deadline;
+			if (late > maxLateNs) {
+				MYVERBOSE("late by %lld ns, resync", late);
+				deadline += late;
+			} else {
+				QMutexLocker lock(&statsMutex);
+				stats.add(late);
+			}
+		}
+
+		length = gen->playNext();
+		if (length < 0)
+			return;
+		deadline += length;
+		sleepUntil(deadline);
+	}
+
+	// Don't leave the key down
+	emit gen->playSound(false);
+}
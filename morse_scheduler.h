@@ -0,0 +1,94 @@
+#ifndef MORSE_SCHEDULER_H
+#define MORSE_SCHEDULER_H
+
+/**
+ * @file
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+
+class GenerateMorse;
+
+
+/*!
+ * \brief How late the elements got keyed
+ *
+ * \sa MorseScheduler::jitter()
+ */
+struct MorseJitter {
+	qint64 count;   //!< \brief number of elements
+	qint64 sumNs;   //!< \brief sum of the delays
+	qint64 maxNs;   //!< \brief biggest delay
+	double sumSq;   //!< \brief sum of the squared delays, in ns^2
+
+	MorseJitter() : count(0), sumNs(0), maxNs(0), sumSq(0) {}
+	void add(qint64 ns);
+	double meanNs() const;
+	double stddevNs() const;
+};
+
+
+/*!
+ * \brief Thread that plays a \ref GenerateMorse with precise timing
+ *
+ * Instead of a QTimer in the GUI thread, this thread sleeps until the
+ * absolute deadline of each element, so neither timer granularity nor a
+ * busy GUI delays the keying.
+ *
+ * The signals of \ref GenerateMorse get emitted from this thread. Whatever
+ * lives in the GUI thread (display, progress bar) is reached through
+ * queued connections automatically. Something that keys a transmitter
+ * should connect to \ref GenerateMorse::playSound(bool) with \c
+ * Qt::DirectConnection, so that it's called right at the deadline.
+ *
+ * \sa GenerateMorse::setRealtime()
+ */
+class MorseScheduler : public QThread {
+	Q_OBJECT
+public:
+	MorseScheduler(GenerateMorse *gen);
+	~MorseScheduler();
+	/*! \brief Use SCHED_FIFO for the thread, if permitted. Set before \c start() */
+	void setFifo(bool on) { fifo = on; }
+	void halt();
+	MorseJitter jitter() const;
+
+	/*!
+	 * \brief Give up the schedule when we're that late, e.g. after a suspend
+	 *
+	 * \ref GenerateMorse::slotPlayNext() uses the same limit.
+	 */
+	static const qint64 maxLateNs = 500000000;
+protected:
+	void run();
+private:
+	qint64 now() const;
+	void sleepUntil(qint64 deadline);
+	GenerateMorse *gen;  //!< \brief what we play
+	bool fifo;           //!< \brief \sa setFifo()
+	QAtomicInt halted;   //!< \brief set by \ref halt()
+	mutable QMutex statsMutex;
+	MorseJitter stats;   //!< \brief \sa jitter()
+	QElapsedTimer clock; //!< \brief time base of \ref now() without clock_gettime()
+};
+
+
+#endif
@@ -0,0 +1,16 @@
+isEmpty(QMAKE_MORSETABLE) {
+    MORSETABLE_BIN = $$TOPDIR/morsetable.py
+    QMAKE_MORSETABLE = python $$MORSETABLE_BIN
+}
+
+isEmpty(MORSETABLE_DIR):MORSETABLE_DIR = .
+
+morsetable.commands = $$QMAKE_MORSETABLE --dir $$MORSETABLE_DIR ${QMAKE_FILE_IN}
+morsetable.output = $$MORSETABLE_DIR/${QMAKE_FILE_BASE}_table$${first(QMAKE_EXT_H)}
+morsetable.depends = $$MORSETABLE_BIN
+morsetable.input = MORSE_TABLE
+morsetable.CONFIG += no_link target_predeps
+morsetable.variable_out = GENERATED_FILES
+morsetable.name = MORSETABLE ${QMAKE_FILE_IN}
+silent:morsetable.commands = @echo morsetable ${QMAKE_FILE_IN} && $$morsetable.commands
+QMAKE_EXTRA_COMPILERS += morsetable
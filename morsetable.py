@@ -0,0 +1,168 @@
+#!/usr/bin/python
+
+#
+# morsetable - turn characters.csv into a static C++ lookup table
+#
+# This script reads the CSV file that loadChars() also reads at runtime and
+# writes a header with the same characters as static const data, so that
+# the Morse class can look them up without touching the heap.
+#
+# Lookup goes through a perfect hash: we search for a seed of the FNV-1a
+# hash (see morseHash() in morse.cpp) that maps every sign into its own
+# slot. The slot array then stores the index into the table, or -1.
+#
+
+from __future__ import print_function
+
+import sys, os
+
+
+#
+# Very simple option parsing
+#
+from optparse import OptionParser
+parser = OptionParser()
+parser.add_option("-d", "--dir", dest="destdir", default=".",
+	help="destination directory", metavar="DIR")
+(options, args) = parser.parse_args()
+if len(args) != 1:
+    print("Usage: %s --dir <dir> <filename>.csv" % sys.argv[0])
+    sys.exit(1)
+
+
+def parseCSV(fname):
+    """Parses the CSV file like ParseCSV::parse() does, returns a list of
+    (sign, code) tuples."""
+
+    records = []
+    for line in open(fname):
+        fields = []
+        item = None
+        escape = False
+        for c in line.rstrip("\r\n"):
+            if item is None:
+                if c == '"':
+                    item = ""
+            elif escape:
+                item += c
+                escape = False
+            elif c == '\\':
+                escape = True
+            elif c == '"':
+                fields.append(item)
+                item = None
+            else:
+                item += c
+        if len(fields) >= 2:
+            records.append((fields[0], fields[1]))
+    return records
+
+
+def morseHash(sign, seed, shift):
+    "Must be the same as morseHash() in morse.cpp"
+
+    h = 2166136261 ^ seed
+    for c in sign:
+        h ^= ord(c)
+        h = (h * 16777619) & 0xffffffff
+    return h >> shift
+
+
+def findSeed(signs):
+    "Searches a seed that gives every sign a slot of it's own"
+
+    for bits in range(7, 16):
+        if (1 << bits) < len(signs):
+            continue
+        shift = 32 - bits
+        for seed in range(0, 200000):
+            used = set()
+            for s in signs:
+                slot = morseHash(s, seed, shift)
+                if slot in used:
+                    break
+                used.add(slot)
+            else:
+                return (seed, bits)
+    raise Exception("no perfect hash found")
+
+
+def packCode(code):
+    """Packs ".-" into the bits and length of a MorseCode, see morse.h.
+    The word space " " becomes length 0."""
+
+    bits = 0
+    n = 0
+    for c in code:
+        if c == '-':
+            bits |= 1 << n
+        if c in ".-":
+            n += 1
+    if n > 16:
+        raise Exception("morse code %s too long" % code)
+    return (bits, n)
+
+
+def quote(s):
+    return '"%s"' % s.replace('\\', '\\\\').replace('"', '\\"')
+
+
+#
+# Load the table. Records without a sign (e.g. non-ASCII characters that
+# got lost in the CSV) can't be looked up and are skipped.
+#
+records = []
+seen = set()
+for (sign, code) in parseCSV(args[0]):
+    if not sign or sign in seen:
+        continue
+    if len(sign) > 4:
+        raise Exception("sign %s too long" % sign)
+    seen.add(sign)
+    records.append((sign, code))
+
+# Tokens are stored in one byte, see GenerateMorse::tokens
+if len(records) > 256:
+    raise Exception("%d signs, but tokens only go up to 256" % len(records))
+
+signs = [sign for (sign, code) in records]
+(seed, hashbits) = findSeed(signs)
+slots = [-1] * (1 << hashbits)
+for n in range(len(signs)):
+    slots[morseHash(signs[n], seed, 32 - hashbits)] = n
+
+
+#
+# Now write this into the header
+#
+basename = os.path.splitext(os.path.basename(args[0]))[0]
+f = open("%s/%s_table.h" % (options.destdir, basename), "w")
+f.write("#ifndef %s_TABLE_H\n" % basename.upper())
+f.write("#define %s_TABLE_H\n" % basename.upper())
+f.write("\n\n")
+f.write("// automatically generated from %s\n" % args[0])
+f.write("\n\n")
+f.write("static const int morseTableSize = %d;\n" % len(records))
+f.write("\n")
+f.write("static const MorseTableEntry morseTable[%d] = {\n" % len(records))
+for (sign, code) in records:
+    (bits, n) = packCode(code)
+    f.write("\t{ %s, %d, { 0x%04x, %d } }, // %s\n" % (quote(sign), len(sign), bits, n, code.strip() or "word space"))
+f.write("};\n")
+f.write("\n")
+f.write("static const quint32 morseHashSeed = %d;\n" % seed)
+f.write("static const int morseHashShift = %d;\n" % (32 - hashbits))
+f.write("\n")
+# One byte per slot as long as the indices fit
+slotType = "qint8" if len(signs) <= 127 else "qint16"
+f.write("static const %s morseHashSlots[%d] = {" % (slotType, len(slots)))
+for n in range(len(slots)):
+    if n % 16 == 0:
+        f.write("\n\t")
+    else:
+        f.write(" ")
+    f.write("%d," % slots[n])
+f.write("\n};\n")
+f.write("\n\n")
+f.write("#endif\n")
+f.close()
@@ -0,0 +1,222 @@
+/*
+ * Renders many morse texts into audio files, on all cores.
+ *
+ * Usage: render_batch [-j threads] manifest.csv
+ *
+ * Each line of the manifest is one job:
+ *
+ *   "file.wav", "text", wpm, pitch[, dit, dah, intra, char, word]
+ *
+ * The optional numbers are the factors of GenerateMorse::setDitFactor()
+ * and friends. Files ending in .wav get a WAV header, others are raw
+ * 16 bit mono samples.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QThread>
+
+#include "morse.h"
+#include "render_morse.h"
+#include "sinesource.h"
+#include "work_pool.h"
+#include "parse_csv.h"
+
+#include <stdio.h>
+
+
+/*!
+ * \brief One line of the manifest
+ */
+struct RenderJob {
+	QString fname;
+	QString text;
+	float wpm;
+	int pitch;
+	float factor[5]; //!< \brief dit, dah, intra, char, word
+
+	RenderJob() : wpm(20), pitch(800) {
+		for (int i = 0; i < 5; i++)
+			factor[i] = 1;
+	}
+};
+
+
+/*!
+ * \brief Reads the manifest into a list of \ref RenderJob
+ */
+class ParseManifest : public ParseCSV {
+public:
+	ParseManifest(const QString &fname) : ParseCSV(fname) {};
+	void setData(int field, const QString &item);
+	void saveRecord();
+
+	QList<RenderJob> jobs;
+private:
+	RenderJob job;
+};
+
+
+void ParseManifest::setData(int field, const QString &item)
+{
+	switch (field) {
+	case 0: job.fname = item; break;
+	case 1: job.text = item; break;
+	case 2: job.wpm = item.toFloat(); break;
+	case 3: job.pitch = item.toInt(); break;
+	default:
+		if (field - 4 < 5)
+			job.factor[field - 4] = item.toFloat();
+	}
+}
+
+
+void ParseManifest::saveRecord()
+{
+	if (!job.fname.isEmpty() && job.wpm > 0)
+		jobs.append(job);
+	else
+		qWarning("skipping job %d", jobs.size() + 1);
+	job = RenderJob();
+}
+
+
+/*!
+ * \brief Renders the jobs, called by the \ref WorkPool workers
+ *
+ * Every worker has it's own GenerateMorse and RenderMorse, so their
+ * buffers get reused from job to job.
+ */
+class RenderTask : public WorkPool::Task {
+public:
+	RenderTask(const QList<RenderJob> &j, int threads);
+	~RenderTask();
+	void runJob(int job, int worker);
+
+	qint64 samples() const;
+	int failed() const;
+private:
+	struct Worker {
+		GenerateMorse *gen;
+		RenderMorse *render;
+		qint64 samples;
+		int failed;
+	};
+	const QList<RenderJob> &jobs;
+	QVector<Worker> workers;
+};
+
+
+RenderTask::RenderTask(const QList<RenderJob> &j, int threads)
+	: jobs(j)
+{
+	Worker w;
+	w.gen = 0;
+	w.render = 0;
+	w.samples = 0;
+	w.failed = 0;
+	workers.fill(w, threads);
+}
+
+
+RenderTask::~RenderTask()
+{
+	for (int i = 0; i < workers.size(); i++) {
+		delete workers[i].gen;
+		delete workers[i].render;
+	}
+}
+
+
+void RenderTask::runJob(int n, int worker)
+{
+	Worker &w = workers[worker];
+	// Created here, so that they belong to the worker thread
+	if (!w.gen) {
+		w.gen = new GenerateMorse;
+		w.gen->setCompact(true);
+		w.render = new RenderMorse;
+	}
+
+	const RenderJob &job = jobs.at(n);
+	GenerateMorse *gen = w.gen;
+	gen->clear();
+	gen->setWpm(job.wpm);
+	gen->setDitFactor(job.factor[0]);
+	gen->setDahFactor(job.factor[1]);
+	gen->setIntraFactor(job.factor[2]);
+	gen->setCharFactor(job.factor[3]);
+	gen->setWordFactor(job.factor[4]);
+	gen->appendText(job.text.constData(), job.text.size(), GenerateMorse::SubstituteUnknown);
+	w.render->setFreq(job.pitch);
+
+	qint64 samples = w.render->renderFile(*gen, job.fname);
+	if (samples < 0) {
+		qWarning("can't write %s", qPrintable(job.fname));
+		w.failed++;
+		return;
+	}
+	w.samples += samples;
+}
+
+
+qint64 RenderTask::samples() const
+{
+	qint64 n = 0;
+	foreach(const Worker &w, workers)
+		n += w.samples;
+	return n;
+}
+
+
+int RenderTask::failed() const
+{
+	int n = 0;
+	foreach(const Worker &w, workers)
+		n += w.failed;
+	return n;
+}
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QStringList args = app.arguments();
+	args.removeFirst();
+	int threads = 0;
+	if (args.size() >= 2 && args.at(0) == "-j") {
+		threads = args.at(1).toInt();
+		args = args.mid(2);
+	}
+	if (args.size() != 1) {
+		fprintf(stderr, "Usage: render_batch [-j threads] manifest.csv\n");
+		return 1;
+	}
+
+	ParseManifest manifest(args.at(0));
+	if (!manifest.parse()) {
+		fprintf(stderr, "can't read %s\n", qPrintable(args.at(0)));
+		return 1;
+	}
+
+	WorkPool pool(threads);
+	RenderTask task(manifest.jobs, pool.threads());
+
+	QElapsedTimer timer;
+	timer.start();
+	pool.run(manifest.jobs.size(), &task);
+	qint64 ms = qMax(timer.elapsed(), (qint64)1);
+
+	double audio = (double)task.samples() / SAMPLE_RATE;
+	printf("%d files, %d failed, %.1f hours of audio in %.2f s\n",
+	       manifest.jobs.size(), task.failed(), audio / 3600, ms / 1e3);
+	printf("%.1f files/s, %.0fx realtime, %d threads\n",
+	       manifest.jobs.size() * 1e3 / ms, audio * 1e3 / ms, pool.threads());
+	for (int i = 0; i < pool.threads(); i++)
+		printf("  worker %2d: %6d jobs, %3d steals\n",
+		       i, pool.jobsDone(i), pool.steals(i));
+
+	return task.failed() ? 1 : 0;
+}
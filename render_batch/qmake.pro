@@ -0,0 +1,33 @@
+TOPDIR = ..
+MVG_OPTIONS *= --no-model --no-view --no-dialog --no-save
+include($$TOPDIR/include.pri)
+
+QT -= gui
+CONFIG *= console
+CONFIG -= app_bundle
+CONFIG -= debug
+CONFIG *= release
+
+TARGET = render_batch
+
+SOURCES *= main.cpp
+
+SOURCES *= $$TOPDIR/mydebug.cpp
+
+SOURCES *= $$TOPDIR/morse.cpp
+HEADERS *= $$TOPDIR/morse.h
+SOURCES *= $$TOPDIR/morse_scheduler.cpp
+HEADERS *= $$TOPDIR/morse_scheduler.h
+SOURCES *= $$TOPDIR/render_morse.cpp
+HEADERS *= $$TOPDIR/render_morse.h
+SOURCES *= $$TOPDIR/impairment.cpp
+HEADERS *= $$TOPDIR/impairment.h
+SOURCES *= $$TOPDIR/sinesource.cpp
+HEADERS *= $$TOPDIR/sinesource.h
+SOURCES *= $$TOPDIR/work_pool.cpp
+HEADERS *= $$TOPDIR/work_pool.h
+
+SOURCES *= $$TOPDIR/parse_csv.cpp
+HEADERS *= $$TOPDIR/parse_csv.h
+MVG_YAML = $$TOPDIR/characters.yaml
+MORSE_TABLE = $$TOPDIR/characters.csv
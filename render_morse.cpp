@@ -0,0 +1,410 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ *
+ * @section DESCRIPTION
+ *
+ * Offline rendering of morse code into raw PCM or WAV files.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include "render_morse.h"
+#include "sinesource.h"
+#include "impairment.h"
+
+#include <QFile>
+
+#include <string.h>
+
+
+/*!
+ * \brief Samples per write to the output device
+ */
+const int chunkSamples = 16384;
+
+
+RenderMorse::RenderMorse(int freq)
+	: chain(0)
+	, useGlyphs(true)
+{
+	MYTRACE("RenderMorse::RenderMorse(%d)", freq);
+
+	gen = new SineSource(freq, 0);
+	buffer = new char[chunkSamples * 2];
+	memset(&glyphTiming, 0, sizeof(glyphTiming));
+}
+
+
+RenderMorse::~RenderMorse()
+{
+	delete gen;
+	delete[] buffer;
+}
+
+
+/*!
+ * \brief Change the pitch of the tone
+ */
+void RenderMorse::setFreq(int freq)
+{
+	gen->setFreq(freq);
+	glyphs.clear();
+}
+
+
+/*!
+ * \brief Change how tones rise and fall, see \ref SineSource::setEnvelope()
+ */
+void RenderMorse::setEnvelope(SineSource::Envelope shape, float riseMs)
+{
+	gen->setEnvelope(shape, riseMs);
+	glyphs.clear();
+}
+
+
+/*!
+ * \brief Run the samples through \a chain before they're written
+ *
+ * Use this to render with noise, fading and so on. The chain isn't owned,
+ * and 0 switches it off again. The silence between the elements goes
+ * through the chain, too.
+ */
+void RenderMorse::setImpairments(ImpairmentChain *_chain)
+{
+	chain = _chain;
+	if (chain)
+		chain->setSampleRate(SAMPLE_RATE);
+}
+
+
+/*!
+ * \brief Switch the cache of character samples on or off
+ *
+ * With the cache, the samples of each character are made only once, the
+ * rest is copying. The cache is thrown away when the timing (e.g. by
+ * \ref GenerateMorse::setWpm() or one of the \c setXFactor() functions),
+ * the pitch or the envelope changes. It's on by default.
+ *
+ * The start of every character is still exactly on the schedule. Inside
+ * of a character, element boundaries may differ by one sample from
+ * rendering without the cache.
+ */
+void RenderMorse::setGlyphCache(bool on)
+{
+	useGlyphs = on;
+	glyphs.clear();
+}
+
+
+/*!
+ * \brief Sample where something at \a ns starts
+ */
+static inline qint64 sampleAt(qint64 ns)
+{
+	return (ns * SAMPLE_RATE + 500000000) / 1000000000;
+}
+
+
+/*!
+ * \brief Returns the samples of one character
+ *
+ * The character is given as it's morse code, like in \ref MorseCode:
+ * bit n set means element n is a dah. The samples cover the tones and
+ * the gaps between them, but not the gap after the character.
+ */
+const QByteArray &RenderMorse::glyph(quint32 bits, int len, const MorseTiming &timing)
+{
+	quint32 key = (len << 16) | bits;
+	QHash<quint32, QByteArray>::const_iterator it = glyphs.constFind(key);
+	if (it != glyphs.constEnd())
+		return it.value();
+
+	MYVERBOSE("new glyph 0x%x, len %d", bits, len);
+	QList<qint64> ends;
+	qint64 ns = 0;
+	for (int i = 0; i < len; i++) {
+		if (i)
+			ends.append(sampleAt(ns += timing.intra));
+		ends.append(sampleAt(ns += (bits >> i) & 1 ? timing.dah : timing.dit));
+	}
+
+	QByteArray pcm((int)ends.last() * 2, 0);
+	qint64 pos = 0;
+	for (int i = 0; i < ends.size(); i++) {
+		qint64 n = ends[i] - pos;
+		// Odd ones are the gaps, SineSource makes silence there
+		if (!(i & 1))
+			gen->setSamples((int)n);
+		gen->readData(pcm.data() + pos * 2, n * 2);
+		pos += n;
+	}
+	glyphs.insert(key, pcm);
+	return glyphs[key];
+}
+
+
+/*!
+ * \brief Write \a n samples of silence
+ *
+ * @returns \a n, or -1 on a write error
+ */
+qint64 RenderMorse::writeSilence(qint64 n, QIODevice *out)
+{
+	memset(buffer, 0, qMin(n, (qint64)chunkSamples) * 2);
+	for (qint64 left = n; left > 0; ) {
+		int len = (int)qMin(left, (qint64)chunkSamples);
+		if (chain) {
+			memset(buffer, 0, len * 2);
+			chain->process((qint16 *)buffer, len);
+		}
+		if (out->write(buffer, len * 2) != len * 2)
+			return -1;
+		left -= len;
+	}
+	return n;
+}
+
+
+/*!
+ * \brief Render elements into 16 bit PCM samples
+ *
+ * @param elements  elements like in \ref GenerateMorse::elements()
+ * @param timing    durations of the elements, e.g. from \ref
+ *                  GenerateMorse::timing()
+ * @param out       where the samples go, must be open for writing
+ * @returns         number of samples written, or -1 on a write error
+ */
+qint64 RenderMorse::render(const QList<int> &elements, const MorseTiming &timing, QIODevice *out)
+{
+	MYTRACE("RenderMorse::render(%d elements)", elements.size());
+
+	if (!useGlyphs)
+		return renderElements(elements, timing, out);
+
+	if (memcmp(&timing, &glyphTiming, sizeof(timing))) {
+		glyphs.clear();
+		glyphTiming = timing;
+	}
+	return renderGlyphs(elements, timing, out);
+}
+
+
+/*!
+ * \brief Render element by element, without the glyph cache
+ */
+qint64 RenderMorse::renderElements(const QList<int> &elements, const MorseTiming &timing, QIODevice *out)
+{
+	qint64 ns = 0;
+	qint64 pos = 0;
+	bool silent = false;
+	foreach(int elem, elements) {
+		ns += timing.element(elem);
+		qint64 n = sampleAt(ns) - pos;
+		if (!n)
+			continue;
+		pos += n;
+
+		if (elem > 0) {
+			gen->setSamples((int)n);
+			silent = false;
+		} else if (!silent) {
+			memset(buffer, 0, chunkSamples * 2);
+			silent = true;
+		}
+		while (n) {
+			int len = (int)qMin(n, (qint64)chunkSamples);
+			// Not read(), QIODevice would buffer ahead
+			if (!silent)
+				gen->readData(buffer, len * 2);
+			else if (chain)
+				memset(buffer, 0, len * 2);
+			if (chain)
+				chain->process((qint16 *)buffer, len);
+			if (out->write(buffer, len * 2) != len * 2)
+				return -1;
+			n -= len;
+		}
+	}
+	return pos;
+}
+
+
+/*!
+ * \brief Render character by character, using the glyph cache
+ *
+ * Each run of tones and intra-character gaps is a character and comes
+ * out of the cache. The other gaps are written as silence up to the
+ * next exact position on the schedule, so small differences inside of a
+ * character never add up.
+ */
+qint64 RenderMorse::renderGlyphs(const QList<int> &elements, const MorseTiming &timing, QIODevice *out)
+{
+	qint64 ns = 0;
+	qint64 pos = 0;
+	int count = elements.size();
+	for (int i = 0; i < count; ) {
+		int elem = elements[i];
+		if (elem <= 0) {
+			ns += timing.element(elem);
+			qint64 n = sampleAt(ns) - pos;
+			if (n > 0) {
+				if (writeSilence(n, out) < 0)
+					return -1;
+				pos += n;
+			}
+			i++;
+			continue;
+		}
+
+		// Collect the character: tones, with intra gaps between them
+		quint32 bits = 0;
+		int len = 0;
+		for (; i < count; i++) {
+			elem = elements[i];
+			// A MorseCode has at most 16 elements, longer runs get split
+			if (len == 16)
+				break;
+			if (elem == -1 && i + 1 < count && elements[i + 1] > 0) {
+				ns += timing.intra;
+				continue;
+			}
+			if (elem <= 0)
+				break;
+			if (elem == 3)
+				bits |= 1 << len;
+			len++;
+			ns += timing.element(elem);
+		}
+
+		const QByteArray &pcm = glyph(bits, len, timing);
+		if (chain) {
+			for (int done = 0; done < pcm.size(); ) {
+				int bytes = qMin(pcm.size() - done, chunkSamples * 2);
+				memcpy(buffer, pcm.constData() + done, bytes);
+				chain->process((qint16 *)buffer, bytes / 2);
+				if (out->write(buffer, bytes) != bytes)
+					return -1;
+				done += bytes;
+			}
+		} else if (out->write(pcm.constData(), pcm.size()) != pcm.size()) {
+			return -1;
+		}
+		pos += pcm.size() / 2;
+	}
+	return pos;
+}
+
+
+/*!
+ * \brief Render the morse storage of \a gen with it's current speed
+ *
+ * \sa render(const QList<int> &, const MorseTiming &, QIODevice *)
+ */
+qint64 RenderMorse::render(const GenerateMorse &gen, QIODevice *out)
+{
+	return render(gen.elements(), gen.timing(), out);
+}
+
+
+/*!
+ * \brief Render into a file
+ *
+ * If \a fname ends with ".wav", a WAV header get's written, otherwise the
+ * file contains just the raw samples. You can convert them like this:
+ * \code
+ *   sox -r 44100 -e signed -b 16 -c 1 a.raw a.wav
+ * \endcode
+ *
+ * @returns number of samples written, or -1 if the file couldn't be
+ *          written
+ */
+qint64 RenderMorse::renderFile(const GenerateMorse &gen, const QString &fname)
+{
+	MYTRACE("RenderMorse::renderFile(%s)", qPrintable(fname));
+
+	QFile f(fname);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return -1;
+
+	bool wav = fname.endsWith(".wav", Qt::CaseInsensitive);
+	if (wav)
+		writeWavHeader(&f);
+	qint64 samples = render(gen, &f);
+	if (samples < 0)
+		return -1;
+	if (wav) {
+		f.seek(0);
+		writeWavHeader(&f, samples);
+	}
+	return samples;
+}
+
+
+/*!
+ * \brief Append a little-endian integer of \a bytes bytes to \a p
+ */
+static char *putLE(char *p, quint32 value, int bytes)
+{
+	while (bytes--) {
+		*p++ = value & 0xff;
+		value >>= 8;
+	}
+	return p;
+}
+
+
+/*!
+ * \brief Write a 44 byte WAV header
+ *
+ * The default is 16 bit mono at \ref SAMPLE_RATE, like \ref render()
+ * makes it.
+ *
+ * @param out      where to write the header
+ * @param samples  number of samples (frames, with stereo) that follow.
+ *                 When this isn't known yet (e.g. on a pipe), leave it
+ *                 out. For a file, seek back and write the header again
+ *                 at the end.
+ * @param rate     sample rate
+ * @param channels 1 or 2
+ * @param type     sample format, float becomes an IEEE float WAV
+ */
+void RenderMorse::writeWavHeader(QIODevice *out, qint64 samples, int rate,
+	int channels, SineSource::SampleType type)
+{
+	int bytes = type == SineSource::Int16 ? 2 : 4;
+	int frame = channels * bytes;
+
+	// Without a size, claim as much as possible
+	const qint64 maxData = 0xffffffffLL - 36;
+	quint32 data = (quint32)(samples < 0 ? maxData : qMin(samples * frame, maxData));
+
+	char hdr[44];
+	char *p = hdr;
+	memcpy(p, "RIFF", 4); p += 4;
+	p = putLE(p, data + 36, 4);
+	memcpy(p, "WAVEfmt ", 8); p += 8;
+	p = putLE(p, 16, 4);               // size of fmt chunk
+	p = putLE(p, type == SineSource::Float32 ? 3 : 1, 2); // PCM or IEEE float
+	p = putLE(p, channels, 2);
+	p = putLE(p, rate, 4);
+	p = putLE(p, rate * frame, 4);     // bytes per second
+	p = putLE(p, frame, 2);            // bytes per frame
+	p = putLE(p, bytes * 8, 2);        // bits per sample
+	memcpy(p, "data", 4); p += 4;
+	p = putLE(p, data, 4);
+	out->write(hdr, sizeof(hdr));
+}
@@ -0,0 +1,85 @@
+#ifndef RENDER_MORSE_H
+#define RENDER_MORSE_H
+
+/**
+ * @file
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include "morse.h"
+#include "sinesource.h"
+
+
+class QIODevice;
+class ImpairmentChain;
+
+
+/*!
+ * \brief Renders morse into PCM samples, without timers or sound card
+ *
+ * The samples come from the same \ref SineSource that \ref AudioOutput
+ * plays, as 16 bit signed mono at \ref SAMPLE_RATE. Element boundaries are
+ * taken from the nanosecond schedule of \ref MorseTiming and rounded to
+ * the nearest sample, so the output is sample-exact and doesn't drift.
+ *
+ * Every character sounds the same each time, so it's samples are made
+ * only once and kept in a cache, see \ref setGlyphCache().
+ *
+ * Usage:
+ * \code
+ *   GenerateMorse gen;
+ *   gen.setWpm(20);
+ *   gen.append("cq de dh3hs");
+ *   RenderMorse render(700);
+ *   render.renderFile(gen, "cq.wav");
+ * \endcode
+ */
+class RenderMorse {
+public:
+	RenderMorse(int freq=800);
+	~RenderMorse();
+	void setFreq(int freq);
+	void setEnvelope(SineSource::Envelope shape, float riseMs);
+	void setImpairments(ImpairmentChain *chain);
+	void setGlyphCache(bool on);
+
+	qint64 render(const QList<int> &elements, const MorseTiming &timing, QIODevice *out);
+	qint64 render(const GenerateMorse &gen, QIODevice *out);
+	qint64 renderFile(const GenerateMorse &gen, const QString &fname);
+
+	static void writeWavHeader(QIODevice *out, qint64 samples=-1, int rate=SAMPLE_RATE,
+		int channels=1, SineSource::SampleType type=SineSource::Int16);
+private:
+	SineSource *gen;  //!< \brief Sample generator
+	char *buffer;     //!< \brief Samples on their way to the output
+	ImpairmentChain *chain; //!< \brief Optional, see \ref setImpairments()
+
+	const QByteArray &glyph(quint32 bits, int len, const MorseTiming &timing);
+	qint64 writeSilence(qint64 n, QIODevice *out);
+	qint64 renderElements(const QList<int> &elements, const MorseTiming &timing, QIODevice *out);
+	qint64 renderGlyphs(const QList<int> &elements, const MorseTiming &timing, QIODevice *out);
+
+	bool useGlyphs;                   //!< \brief See \ref setGlyphCache()
+	QHash<quint32, QByteArray> glyphs; //!< \brief Samples of characters, key is length << 16 | bits
+	MorseTiming glyphTiming;          //!< \brief Timing the \ref glyphs were made with
+};
+
+
+#endif
@@ -0,0 +1,543 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Simple sine audio generator.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "sinesource.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/*!
+ * \brief Samples per block in \ref SineSource::generate()
+ */
+const int SineSource::blockSize;
+
+#ifndef M_PI
+/*!
+ * \brief Representation of pi
+ */
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/*!
+ * \brief Size of the wave table is 2^tableBits
+ */
+static const int tableBits = 12;
+
+/*!
+ * \brief Shift from the 32 bit phase to a wave table index
+ */
+static const int phaseShift = 32 - tableBits;
+
+/*!
+ * \brief One full sine wave, see \ref SineTable
+ */
+static qint16 table[1 << tableBits];
+
+
+/*!
+ * \brief Fills \ref table when the program starts
+ *
+ * Sources also get created in worker threads, e.g. by render_batch. So
+ * the table has to be complete before any thread reads it.
+ */
+static struct SineTable {
+	SineTable()
+	{
+		for (int i = 0; i < (1 << tableBits); i++)
+			table[i] = (qint16)floor(32767.0 * sin(M_PI * 2 * i / (1 << tableBits)) + 0.5);
+	}
+} sineTable;
+
+
+/*!
+ * \brief Sine wave generator source for \ref AudioOutput
+ *
+ * @param freq    desired frequency of sine wave
+ * @param parent  parent QObject, if any
+ *
+ * This class is taylored to be used with \ref AudioOutput, which lets the
+ * sound card pull from it:
+ *
+ * \code
+ *   gen = new SineSource(800, this);
+ *   audioOutput->start(gen);
+ *   ...
+ *   gen->setDuration(ms);
+ * \endcode
+ *
+ * It never runs dry: after the tone it delivers silence. The device is
+ * unbuffered, so a read goes straight into \ref readData() and nothing is
+ * generated ahead of time.
+ *
+ * The sine is made by a numerically controlled oscillator: a 32 bit phase
+ * accumulator runs through a wave table of one full wave. The phase wraps
+ * around by itself, so there's never a glitch, and it keeps running over
+ * silence, so consecutive elements are phase continuous.
+ */
+SineSource::SineSource(int freq, QObject *parent)
+	: QIODevice(parent)
+	, rate(SAMPLE_RATE)
+	, channels(1)
+	, type(Int16)
+	, phase(0)
+	, samples(0)
+	, toneLen(0)
+{
+	setFreq(freq);
+	setEnvelope(RaisedCosine, 5);
+	open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+
+/*!
+ * \brief Class destructor
+ */
+SineSource::~SineSource()
+{
+}
+
+
+/*!
+ * \brief Change generated frequency
+ *
+ * This only changes the phase increment, so it's cheap and can be done at
+ * any time, even in the middle of a tone.
+ *
+ * @param frequency desiged frequency in Hz. Should be below 10000 Hertz.
+ */
+void SineSource::setFreq(int frequency)
+{
+	MYTRACE("SineSource::setFreq(%d)", frequency);
+
+	const int upper_freq = 10000;
+
+	// Arbitrary upper frequency
+	freq = qBound(0, frequency, upper_freq);
+
+	// 2^32 is one full wave
+	phaseInc = (quint32)(((quint64)freq << 32) / rate);
+	MYVERBOSE("phase increment 0x%08x", phaseInc);
+
+	// Rotation inside of a block, see generate()
+	double d = M_PI * 2 * phaseInc / 4294967296.0;
+	for (int k = 0; k < blockSize; k++) {
+		blockSin[k] = sin(k * d);
+		blockCos[k] = cos(k * d);
+	}
+}
+
+
+/*!
+ * \brief Generate sine for \c ms milliseconds
+ *
+ * This calculates how many \ref samples are needed for the specified
+ * sound duration duration. Later, \ref readData() won't return more than
+ * this number of samples.
+ *
+ * @param ms   sound duration in milliseconds
+ */
+void SineSource::setDuration(int ms)
+{
+	samples = (int)(((qint64)rate * ms) / 1000);
+	samples &= 0x7ffffffe;
+	toneLen = samples;
+}
+
+
+/*!
+ * \brief Generate sine for exactly \a n samples
+ *
+ * Like \ref setDuration(), but doesn't round to milliseconds. This is
+ * used for offline rendering, where every sample counts.
+ */
+void SineSource::setSamples(int n)
+{
+	samples = n;
+	toneLen = n;
+}
+
+
+/*!
+ * \brief Set the format of the samples that \ref readData() returns
+ *
+ * The sine is always calculated as 16 bit mono, then converted to what
+ * the sound card wants. This way the sound card never has to convert or
+ * resample by itself. Multi-byte samples are little endian.
+ *
+ * @param sampleRate  samples per second, e.g. 44100 or 48000
+ * @param chans       1 for mono, 2 for stereo (both get the same)
+ * @param sampleType  \ref Int16, \ref Int32 or \ref Float32
+ */
+void SineSource::setFormat(int sampleRate, int chans, SampleType sampleType)
+{
+	MYTRACE("SineSource::setFormat(%d, %d, %d)", sampleRate, chans, sampleType);
+
+	rate = sampleRate > 0 ? sampleRate : SAMPLE_RATE;
+	channels = qBound(1, chans, 2);
+	type = sampleType;
+
+	// Everything that depends on the sample rate
+	setFreq(freq);
+	setEnvelope(envShape, envRiseMs);
+}
+
+
+/*!
+ * \brief Returns the size of one sample frame (all channels) in bytes
+ */
+int SineSource::frameBytes() const
+{
+	return channels * (type == Int16 ? 2 : 4);
+}
+
+
+/*!
+ * \brief Returns the sample rate, see \ref setFormat()
+ */
+int SineSource::sampleRate() const
+{
+	return rate;
+}
+
+
+/*!
+ * \brief Returns how many samples of the current tone are still to come
+ *
+ * 0 means that \ref readData() only delivers silence.
+ */
+int SineSource::remainingSamples() const
+{
+	return samples;
+}
+
+
+/*!
+ * \brief Set how a tone rises and falls
+ *
+ * Hard keying makes clicks, and on the air it splatters over the band.
+ * With an envelope the tone rises within \a riseMs at it's start, and
+ * falls the same way at it's end. Both happen inside the tone, so the
+ * tone still starts and ends exactly at the element boundaries.
+ *
+ * The rise is calculated here once into \ref rampUp and \ref rampDown,
+ * generating samples only multiplies with them.
+ *
+ * @param shape   form of the rise and fall
+ * @param riseMs  duration of the rise, e.g. 5 ms
+ */
+void SineSource::setEnvelope(Envelope shape, float riseMs)
+{
+	MYTRACE("SineSource::setEnvelope(%d, %f)", shape, riseMs);
+
+	envShape = shape;
+	envRiseMs = riseMs;
+	int n = shape == HardKeying ? 0 : (int)(riseMs * rate / 1000 + 0.5);
+	rampUp.resize(n);
+	rampDown.resize(n);
+	for (int i = 0; i < n; i++) {
+		double t = (i + 0.5) / n;
+		double g = t;
+		switch (shape) {
+		case HardKeying:
+		case LinearRamp:
+			break;
+		case RaisedCosine:
+			g = 0.5 - 0.5 * cos(M_PI * t);
+			break;
+		case BlackmanHarris:
+			// rising half of a Blackman-Harris window
+			g = 0.35875
+				- 0.48829 * cos(M_PI * t)
+				+ 0.14128 * cos(M_PI * 2 * t)
+				- 0.01168 * cos(M_PI * 3 * t);
+			break;
+		}
+		rampUp[i] = (qint16)qBound(0.0, g * 32767 + 0.5, 32767.0);
+		rampDown[n - 1 - i] = rampUp[i];
+	}
+}
+
+
+/*!
+ * \brief Multiply \a n samples with \a n gains
+ *
+ * The gains are 1.15 fixed point, so 32767 is (almost) 1.0.
+ */
+static void applyGain(qint16 *out, const qint16 *gain, int n)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(out + i));
+		__m128i g = _mm_loadu_si128((const __m128i *)(gain + i));
+		// (x * g) >> 16, then one bit back up
+		x = _mm_slli_epi16(_mm_mulhi_epi16(x, g), 1);
+		_mm_storeu_si128((__m128i *)(out + i), x);
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = (qint16)((out[i] * gain[i]) >> 15);
+}
+
+
+/*!
+ * \brief Generate \a n samples of the current tone, with it's envelope
+ *
+ * Only the samples in the rise and the fall get touched, the rest of the
+ * tone costs nothing extra.
+ */
+void SineSource::synth(qint16 *out, int n)
+{
+	generate(out, n);
+
+	int pos = toneLen - samples;    // position of out[0] in the tone
+	int ramp = rampUp.size();
+	if (ramp) {
+		// Tones shorter than two ramps don't reach full volume
+		int up = qMin(ramp, (toneLen + 1) / 2);
+		int down = qMin(ramp, toneLen / 2);
+		int from = qMax(pos, 0);
+		int to = qMin(pos + n, up);
+		if (from < to)
+			applyGain(out + from - pos, rampUp.constData() + from, to - from);
+		int start = toneLen - down;
+		from = qMax(pos, start);
+		to = pos + n;
+		if (from < to)
+			applyGain(out + from - pos, rampDown.constData() + ramp - down + from - start, to - from);
+	}
+	samples -= n;
+}
+
+
+/*!
+ * \brief Write \a n samples of the sine to \a out
+ *
+ * This advances the phase, but doesn't care about \ref samples.
+ *
+ * The SIMD versions (SSE2, or AVX2 with "qmake CONFIG+=avx2") don't look
+ * up every sample. Instead they take sine and cosine of the phase at the
+ * start of a block of \ref blockSize samples from the table, and rotate
+ * them with \ref blockSin and \ref blockCos:
+ *
+ *   sin(p + k*d) = sin(p) * cos(k*d) + cos(p) * sin(k*d)
+ *
+ * The phase accumulator stays exact, so the error of the table doesn't
+ * add up from block to block.
+ */
+void SineSource::generate(qint16 *out, int n)
+{
+	quint32 p = phase;
+	const quint32 inc = phaseInc;
+	int i = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	const int quarter = 1 << (tableBits - 2);
+	const int mask = (1 << tableBits) - 1;
+	for (; i + blockSize <= n; i += blockSize) {
+		// Nearest table entry for the phase at the start of the block
+		int idx = ((p + (1u << (phaseShift - 1))) >> phaseShift) & mask;
+		float sinp = table[idx];
+		float cosp = table[(idx + quarter) & mask];
+#if defined(__AVX2__)
+		__m256 s = _mm256_set1_ps(sinp);
+		__m256 c = _mm256_set1_ps(cosp);
+		__m256i v0 = _mm256_cvtps_epi32(_mm256_add_ps(
+			_mm256_mul_ps(s, _mm256_loadu_ps(blockCos)),
+			_mm256_mul_ps(c, _mm256_loadu_ps(blockSin))));
+		__m256i v1 = _mm256_cvtps_epi32(_mm256_add_ps(
+			_mm256_mul_ps(s, _mm256_loadu_ps(blockCos + 8)),
+			_mm256_mul_ps(c, _mm256_loadu_ps(blockSin + 8))));
+		// packs works per 128 bit lane, permute restores the order
+		__m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(v0, v1), 0xd8);
+		_mm256_storeu_si256((__m256i *)(out + i), v);
+#else
+		__m128 s = _mm_set1_ps(sinp);
+		__m128 c = _mm_set1_ps(cosp);
+		for (int j = 0; j < blockSize; j += 8) {
+			__m128i v0 = _mm_cvtps_epi32(_mm_add_ps(
+				_mm_mul_ps(s, _mm_loadu_ps(blockCos + j)),
+				_mm_mul_ps(c, _mm_loadu_ps(blockSin + j))));
+			__m128i v1 = _mm_cvtps_epi32(_mm_add_ps(
+				_mm_mul_ps(s, _mm_loadu_ps(blockCos + j + 4)),
+				_mm_mul_ps(c, _mm_loadu_ps(blockSin + j + 4))));
+			_mm_storeu_si128((__m128i *)(out + i + j), _mm_packs_epi32(v0, v1));
+		}
+#endif
+		p += inc * blockSize;
+	}
+#endif
+
+	for (; i < n; i++) {
+		out[i] = table[p >> phaseShift];
+		p += inc;
+	}
+	phase = p;
+}
+
+
+/*!
+ * \brief Convert \a n mono samples into \a channels of \a type
+ *
+ * Int32 keeps the 16 bits in the upper half, Float32 is scaled to
+ * -1.0 .. 1.0. Stereo gets the same sample on both channels.
+ */
+static void convert(const qint16 *in, char *out, int n, int channels, SineSource::SampleType type)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(1.0f / 32768);
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		if (type == SineSource::Int16) {
+			if (channels == 1) {
+				_mm_storeu_si128((__m128i *)out, x);
+				out += 16;
+			} else {
+				_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(x, x));
+				_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi16(x, x));
+				out += 32;
+			}
+			continue;
+		}
+
+		// Sample into the upper half of 32 bits
+		__m128i lo = _mm_unpacklo_epi16(zero, x);
+		__m128i hi = _mm_unpackhi_epi16(zero, x);
+		if (type == SineSource::Float32) {
+			lo = _mm_castps_si128(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(lo, 16)), scale));
+			hi = _mm_castps_si128(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(hi, 16)), scale));
+		}
+		if (channels == 1) {
+			_mm_storeu_si128((__m128i *)out, lo);
+			_mm_storeu_si128((__m128i *)(out + 16), hi);
+			out += 32;
+		} else {
+			_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi32(lo, lo));
+			_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi32(lo, lo));
+			_mm_storeu_si128((__m128i *)(out + 32), _mm_unpacklo_epi32(hi, hi));
+			_mm_storeu_si128((__m128i *)(out + 48), _mm_unpackhi_epi32(hi, hi));
+			out += 64;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		for (int c = 0; c < channels; c++) {
+			switch (type) {
+			case SineSource::Int16: {
+				qint16 v = in[i];
+				memcpy(out, &v, 2);
+				out += 2;
+				break; }
+			case SineSource::Int32: {
+				qint32 v = (qint32)in[i] << 16;
+				memcpy(out, &v, 4);
+				out += 4;
+				break; }
+			case SineSource::Float32: {
+				float v = in[i] * (1.0f / 32768);
+				memcpy(out, &v, 4);
+				out += 4;
+				break; }
+			}
+		}
+	}
+}
+
+
+/*!
+ * \brief Returns samples of the sine
+ *
+ * Is is a on overwritten method from \c QIODevice which will return the
+ * samples of a sine-wave, in the format set by \ref setFormat(). That's
+ * 16 bit signed little endian mono by default.
+ *
+ * You need to call \ref setDuration() first. After that many samples, only
+ * silence get's returned. The oscillator keeps running, so the next tone
+ * continues with the right phase.
+ *
+ * @param data    destination address
+ * @param maxlen  maximum bytes to copy
+ * @returns       number of bytes copied
+ */
+qint64 SineSource::readData(char *data, qint64 maxlen)
+{
+	MYTRACE("SineSource::readData(data, %lld, samples %d)", maxlen, samples);
+
+	int frame = frameBytes();
+	qint64 n = maxlen / frame;
+	int tone = (int)qMin(n, (qint64)samples);
+
+	if (tone) {
+		if (type == Int16 && channels == 1 && !((quintptr)data & 1)) {
+			// Native format, generate in place
+			synth((qint16 *)data, tone);
+		} else {
+			// Go through a properly aligned buffer
+			qint16 block[1024];
+			for (int done = 0; done < tone; ) {
+				int len = qMin(tone - done, 1024);
+				synth(block, len);
+				convert(block, data + done * frame, len, channels, type);
+				done += len;
+			}
+		}
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+		int size = type == Int16 ? 2 : 4;
+		for (char *p = data; p < data + tone * frame; p += size)
+			std::reverse(p, p + size);
+#endif
+	}
+
+	// Silence, but the oscillator keeps running. All-zero bytes are
+	// silence in every format, even in Float32
+	memset(data + tone * frame, 0, maxlen - tone * frame);
+	phase += phaseInc * (quint32)(n - tone);
+	return maxlen;
+}
+
+
+/*!
+ * \brief Dummy implementation
+ *
+ * This dummy implementation does nothing and is just needed to inherit
+ * successfully from \c QIODevice.
+ */
+qint64 SineSource::writeData(const char *data, qint64 len)
+{
+	Q_UNUSED(data);
+	Q_UNUSED(len);
+
+	return 0;
+}
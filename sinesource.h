@@ -0,0 +1,93 @@
+#ifndef SINESOURCE_H
+#define SINESOURCE_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QIODevice>
+#include <QVector>
+
+
+/*!
+ * \brief Default sample rate of sound card
+ *
+ * In Hertz. \ref AudioOutput may negotiate another one, see
+ * \ref SineSource::setFormat().
+ */
+#define SAMPLE_RATE 44100
+
+
+/*!
+ * \brief Sine wave generator source for \ref AudioOutput
+ */
+class SineSource : public QIODevice
+{
+public:
+	/*! \brief How tones rise and fall, see \ref setEnvelope() */
+	enum Envelope {
+		HardKeying,     //!< \brief no envelope at all, this clicks
+		LinearRamp,     //!< \brief straight line
+		RaisedCosine,   //!< \brief half a cosine wave, the default
+		BlackmanHarris  //!< \brief rising half of a Blackman-Harris window
+	};
+
+	/*! \brief Sample formats for \ref readData(), see \ref setFormat() */
+	enum SampleType {
+		Int16,   //!< \brief signed 16 bit
+		Int32,   //!< \brief signed 32 bit
+		Float32  //!< \brief float, -1.0 .. 1.0
+	};
+
+	SineSource(int freq, QObject *parent);
+	~SineSource();
+	void setFreq(int freq);
+	void setDuration(int ms);
+	void setSamples(int n);
+	void setEnvelope(Envelope shape, float riseMs);
+	void setFormat(int sampleRate, int chans, SampleType sampleType);
+	int frameBytes() const;
+	int sampleRate() const;
+	int remainingSamples() const;
+	void generate(qint16 *out, int n);
+
+	qint64 readData(char *data, qint64 maxlen);
+	qint64 writeData(const char *data, qint64 len);
+
+private:
+	int freq;
+	int rate;         //!< \brief Sample rate, see \ref setFormat()
+	int channels;     //!< \brief 1 or 2, see \ref setFormat()
+	SampleType type;  //!< \brief Format of the samples, see \ref setFormat()
+	quint32 phase;    //!< \brief Phase accumulator, 2^32 is one full wave
+	quint32 phaseInc; //!< \brief Phase increment per sample, see \ref setFreq()
+	int samples;      //!< \brief Samples to play for desired sound duration
+	int toneLen;      //!< \brief Length of the current tone in samples
+
+	Envelope envShape; //!< \brief Shape of the envelope, see \ref setEnvelope()
+	float envRiseMs;   //!< \brief Rise time, see \ref setEnvelope()
+	QVector<qint16> rampUp;   //!< \brief Gains for the rise, see \ref setEnvelope()
+	QVector<qint16> rampDown; //!< \brief Same, reversed for the fall
+	void synth(qint16 *out, int n);
+
+	static const int blockSize = 16;
+	float blockSin[blockSize]; //!< \brief sin(k * phaseInc), see \ref generate()
+	float blockCos[blockSize]; //!< \brief cos(k * phaseInc), see \ref generate()
+};
+
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Decodes all morse signals in recordings, like a CW skimmer.
+ *
+ * Usage: skim_morse [-j threads] [-l lowHz] [-h highHz] file...
+ *
+ * Files are 16 bit WAV, or raw 16 bit mono samples at 44100 Hz. "-" is
+ * stdin. For each signal heard, a line with the time, the pitch and the
+ * decoded text is printed:
+ *
+ *   00:01:23.450   700 Hz  cq test dl1abc dl1abc test
+ *
+ * A pause of a few seconds starts a new line.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include "skimmer.h"
+
+#include <stdio.h>
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QStringList args = app.arguments();
+	args.removeFirst();
+	int threads = 0;
+	int lowHz = 300;
+	int highHz = 3500;
+	while (args.size() >= 2 && args.at(0).startsWith("-") && args.at(0) != "-") {
+		QString opt = args.takeFirst();
+		int value = args.takeFirst().toInt();
+		if (opt == "-j")
+			threads = value;
+		else if (opt == "-l")
+			lowHz = value;
+		else if (opt == "-h")
+			highHz = value;
+		else {
+			args.clear();
+			break;
+		}
+	}
+	if (args.isEmpty()) {
+		fprintf(stderr, "Usage: skim_morse [-j threads] [-l lowHz] [-h highHz] file...\n");
+		return 1;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	double audio = 0;
+	int failed = 0;
+	foreach(const QString &fname, args) {
+		Skimmer skim(SAMPLE_RATE, lowHz, highHz, threads);
+		if (!skim.decodeFile(fname)) {
+			failed++;
+			continue;
+		}
+		audio += (double)skim.frames() / skim.sampleRate();
+		if (args.size() > 1)
+			printf("%s:\n", qPrintable(fname));
+		foreach(const Skimmer::Spot &spot, skim.takeText()) {
+			qint64 ms = spot.ms;
+			printf("%02lld:%02lld:%06.3f %5d Hz  %s\n",
+			       ms / 3600000, ms / 60000 % 60, ms % 60000 / 1e3,
+			       spot.freq, qPrintable(spot.text));
+		}
+	}
+	qint64 ms = qMax(timer.elapsed(), (qint64)1);
+
+	fprintf(stderr, "%.1f min of audio in %.2f s, %.0fx realtime\n",
+	        audio / 60, ms / 1e3, audio * 1e3 / ms);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+TOPDIR = ..
+MVG_OPTIONS *= --no-model --no-view --no-dialog --no-save
+include($$TOPDIR/include.pri)
+
+QT -= gui
+CONFIG *= console
+CONFIG -= app_bundle
+CONFIG -= debug
+CONFIG *= release
+
+TARGET = skim_morse
+
+SOURCES *= main.cpp
+
+SOURCES *= $$TOPDIR/mydebug.cpp
+
+SOURCES *= $$TOPDIR/morse.cpp
+HEADERS *= $$TOPDIR/morse.h
+SOURCES *= $$TOPDIR/morse_scheduler.cpp
+HEADERS *= $$TOPDIR/morse_scheduler.h
+SOURCES *= $$TOPDIR/decode_morse.cpp
+HEADERS *= $$TOPDIR/decode_morse.h
+SOURCES *= $$TOPDIR/decode_audio.cpp
+HEADERS *= $$TOPDIR/decode_audio.h
+SOURCES *= $$TOPDIR/decode_viterbi.cpp
+HEADERS *= $$TOPDIR/decode_viterbi.h
+SOURCES *= $$TOPDIR/skimmer.cpp
+HEADERS *= $$TOPDIR/skimmer.h
+SOURCES *= $$TOPDIR/work_pool.cpp
+HEADERS *= $$TOPDIR/work_pool.h
+
+SOURCES *= $$TOPDIR/parse_csv.cpp
+HEADERS *= $$TOPDIR/parse_csv.h
+MVG_YAML = $$TOPDIR/characters.yaml
+MORSE_TABLE = $$TOPDIR/characters.csv
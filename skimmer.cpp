@@ -0,0 +1,655 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section DESCRIPTION
+ *
+ * Decodes many morse signals side by side in one audio band, like a CW
+ * skimmer does.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QFile>
+#include <QtAlgorithms>
+#include <QtEndian>
+#include <math.h>
+#include <string.h>
+#include "skimmer.h"
+#include "decode_audio.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/*!
+ * \brief Widest channel of the filter bank in Hz
+ *
+ * The FFT gets as long as needed to make the channels this narrow or
+ * narrower. Narrower channels separate signals better, but smear the
+ * tones in time, so that fast morse gets lost.
+ */
+#define BIN_HZ 100
+
+
+/*!
+ * \brief Taps of the polyphase filter per channel
+ *
+ * The prototype low pass is this many FFT lengths long. More taps give
+ * steeper channel edges.
+ */
+#define TAPS 4
+
+
+/*!
+ * \brief Filter bank outputs per chunk
+ *
+ * Each chunk goes through the \ref WorkPool twice, so it should be big
+ * enough that starting the threads doesn't matter.
+ */
+#define CHUNK_HOPS 2048
+
+
+/*!
+ * \brief Filter bank outputs per job when channelizing
+ */
+#define SLICE 64
+
+
+/*!
+ * \brief A channel two channels away must be this much louder to hide it
+ *
+ * It's about 30 dB. Channels right next to each other hide the weaker
+ * one, as they hear the same signal.
+ */
+#define LEAK 30.0f
+
+
+/*!
+ * \brief A channel next to it must be this much louder to hide it, if it's no peak
+ *
+ * A channel between two signals hears both of them, so it can be a bit
+ * louder than the one next to it that has a signal of it's own.
+ */
+#define SLOPE 2.0f
+
+
+/*!
+ * \brief Signal must be this much louder than the noise to be reported
+ */
+#define SPOT_SNR 4.0f
+
+
+/*!
+ * \brief Signals this much weaker than the loudest one aren't reported
+ *
+ * It's about 50 dB. In a clean recording there's no noise to compare
+ * with, and the clicks and harmonics of loud signals would be decoded.
+ */
+#define RANGE 316.0f
+
+
+/*!
+ * \brief A pause this long starts a new \ref Skimmer::Spot
+ */
+#define SPOT_PAUSE_MS 3000
+
+
+/*!
+ * \brief Levels of the last minute stay for words that aren't finished
+ *
+ * A word can't be longer, but it's level must still be compared with
+ * the other channels when \ref Skimmer::takeText() returns it.
+ */
+#define KEEP_LEVELS_MS 60000
+
+
+/*!
+ * \brief Frames per read in \ref Skimmer::decodeFile()
+ */
+#define READ_FRAMES 16384
+
+
+/*!
+ * \brief Returns true if channel \a b is as loud as the ones next to it
+ */
+static bool isTop(const QVector<float> &level, int b)
+{
+	return (b == 0 || level[b - 1] <= level[b])
+		&& (b + 1 == level.size() || level[b + 1] <= level[b]);
+}
+
+
+/*!
+ * \brief Returns true if the \a level of channel \a bin is a signal of it's own
+ *
+ * A louder channel next to it hides it, if that one is a peak. Otherwise
+ * the louder one may just be between two signals and hear both of them,
+ * then it only hides a valley or a much weaker channel.
+ */
+static bool ownSignal(const QVector<float> &level, int bin, float noise)
+{
+	float s = level[bin];
+	if (s < noise * SPOT_SNR)
+		return false;
+	bool valley = (bin == 0 || level[bin - 1] >= s)
+		&& (bin + 1 == level.size() || level[bin + 1] >= s);
+	for (int b = 0; b < level.size(); b++) {
+		int d = qAbs(b - bin);
+		if (!d)
+			continue;
+		if (s * RANGE < level[b])
+			return false;
+		if (d == 1 && level[b] > s && (isTop(level, b) || valley || level[b] > s * SLOPE))
+			return false;
+		if (d == 2 && level[b] > s * LEAK && isTop(level, b))
+			return false;
+	}
+	return true;
+}
+
+
+/*!
+ * \brief Complex FFT in place, radix 2
+ *
+ * @param re   real parts
+ * @param im   imaginary parts
+ * @param n    length, a power of 2
+ * @param c    cos(2 pi i / n) for i < n / 2
+ * @param s    sin(2 pi i / n) for i < n / 2
+ * @param rev  bit reversed index for i < n
+ */
+static void fft(float *re, float *im, int n, const float *c, const float *s, const int *rev)
+{
+	for (int i = 0; i < n; i++) {
+		int j = rev[i];
+		if (i < j) {
+			qSwap(re[i], re[j]);
+			qSwap(im[i], im[j]);
+		}
+	}
+	for (int size = 2; size <= n; size *= 2) {
+		int half = size / 2;
+		int step = n / size;
+		for (int i = 0; i < n; i += size) {
+			for (int j = 0; j < half; j++) {
+				float wr = c[j * step];
+				float wi = -s[j * step];
+				int a = i + j;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+
+static bool spotBefore(const Skimmer::Spot &a, const Skimmer::Spot &b)
+{
+	return a.ms < b.ms || (a.ms == b.ms && a.freq < b.freq);
+}
+
+
+/*!
+ * \brief Creates a skimmer for the band from \a _lowHz to \a _highHz
+ *
+ * @param sampleRate  samples per second
+ * @param _lowHz      lowest pitch to decode
+ * @param _highHz     highest pitch to decode
+ * @param threads     worker threads, 0 for one per core
+ */
+Skimmer::Skimmer(int sampleRate, int _lowHz, int _highHz, int threads)
+	: rate(sampleRate)
+	, channels(1)
+	, lowHz(_lowHz)
+	, highHz(_highHz)
+	, frameCount(0)
+	, pool(threads)
+	, phase(Channelize)
+	, chunkHops(0)
+	, flushed(false)
+{
+	MYTRACE("Skimmer::Skimmer(%d, %d, %d)", sampleRate, _lowHz, _highHz);
+
+	setup();
+}
+
+
+Skimmer::~Skimmer()
+{
+	qDeleteAll(decoders);
+}
+
+
+/*!
+ * \brief Set the format of the samples
+ *
+ * \ref decodeFile() of a WAV file sets this from the header. Call it
+ * before the first samples, it starts over.
+ *
+ * @param sampleRate  samples per second
+ * @param chans       channels per frame, they get mixed to mono
+ */
+void Skimmer::setFormat(int sampleRate, int chans)
+{
+	rate = sampleRate;
+	channels = qMax(chans, 1);
+	setup();
+}
+
+
+/*!
+ * \brief Returns the sample rate, see \ref setFormat()
+ */
+int Skimmer::sampleRate() const
+{
+	return rate;
+}
+
+
+/*!
+ * \brief Returns the width of one channel of the filter bank
+ */
+int Skimmer::binHz() const
+{
+	return rate / fftLen;
+}
+
+
+/*!
+ * \brief Design the filter bank and create the decoders
+ *
+ * The prototype low pass is a sinc, cut off at half the channel spacing,
+ * with a Blackman-Harris window. It's scaled so that a sine with
+ * amplitude 1.0 in the middle of a channel gives a level of 1.0.
+ */
+void Skimmer::setup()
+{
+	fftLen = 16;
+	while (rate / fftLen > BIN_HZ)
+		fftLen *= 2;
+	// 4 times oversampled in time, so that dits are still a few hops long
+	hop = fftLen / 4;
+
+	int len = fftLen * TAPS;
+	proto.resize(len);
+	double sum = 0;
+	for (int n = 0; n < len; n++) {
+		double t = (n - (len - 1) / 2.0) / fftLen;
+		double sinc = t == 0 ? 1 : sin(M_PI * t) / (M_PI * t);
+		double x = 2 * M_PI * (n + 0.5) / len;
+		double win = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+		proto[n] = sinc * win;
+		sum += proto[n];
+	}
+	for (int n = 0; n < len; n++)
+		proto[n] *= 2 / sum;
+
+	cosTab.resize(fftLen / 2);
+	sinTab.resize(fftLen / 2);
+	for (int i = 0; i < fftLen / 2; i++) {
+		cosTab[i] = cos(2 * M_PI * i / fftLen);
+		sinTab[i] = sin(2 * M_PI * i / fftLen);
+	}
+	int bits = 0;
+	while ((1 << bits) < fftLen)
+		bits++;
+	bitrev.resize(fftLen);
+	for (int i = 0; i < fftLen; i++) {
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		bitrev[i] = r;
+	}
+
+	float width = (float)rate / fftLen;
+	firstBin = qMax(1, (int)ceilf(lowHz / width));
+	int lastBin = qMin(fftLen / 2 - 1, (int)(highHz / width));
+	qDeleteAll(decoders);
+	decoders.clear();
+	for (int k = firstBin; k <= lastBin; k++)
+		decoders.append(new DecodeLevel(hop * 1000.0f / rate));
+	MYVERBOSE("%d channels of %.1f Hz, hop %d", decoders.size(), width, hop);
+
+	// The filter starts with silence as history, the decoders don't get
+	// to hear it
+	input.fill(0, len - hop + CHUNK_HOPS * hop);
+	fill = len - hop;
+	warmup = fill / hop;
+	levels.resize(decoders.size() * CHUNK_HOPS);
+	scratch.resize(pool.threads());
+	for (int i = 0; i < scratch.size(); i++)
+		scratch[i].resize(2 * fftLen);
+	frameCount = 0;
+	flushed = false;
+}
+
+
+/*!
+ * \brief Decode \a n mono samples, where 1.0 is full scale
+ */
+void Skimmer::process(const float *samples, int n)
+{
+	frameCount += n;
+	flushed = false;
+	while (n > 0) {
+		int len = qMin(n, input.size() - fill);
+		memcpy(input.data() + fill, samples, len * sizeof(float));
+		fill += len;
+		samples += len;
+		n -= len;
+		if (fill == input.size())
+			runChunk(CHUNK_HOPS);
+	}
+}
+
+
+/*!
+ * \brief Decode \a n frames of 16 bit samples
+ *
+ * The frames have as many channels as set with \ref setFormat(), they're
+ * in the byte order of the machine.
+ */
+void Skimmer::process(const qint16 *frames, int n)
+{
+	float buf[READ_FRAMES];
+	while (n > 0) {
+		int len = qMin(n, READ_FRAMES);
+		DecodeAudio::toFloat(frames, len, channels, buf);
+		process(buf, len);
+		frames += len * channels;
+		n -= len;
+	}
+}
+
+
+/*!
+ * \brief Decode a whole WAV or raw file, "-" is stdin
+ *
+ * Raw files are read in the format of \ref setFormat(). Of WAV files only
+ * the samples get decoded, not the chunks after them.
+ *
+ * @returns false if the file can't be read
+ */
+bool Skimmer::decodeFile(const QString &fname)
+{
+	MYTRACE("Skimmer::decodeFile(%s)", qPrintable(fname));
+
+	QFile file(fname);
+	bool ok;
+	if (fname == "-")
+		ok = file.open(stdin, QIODevice::ReadOnly);
+	else
+		ok = file.open(QIODevice::ReadOnly);
+	if (!ok) {
+		qWarning("Can't read %s", qPrintable(fname));
+		return false;
+	}
+	qint64 left = -1;
+	if (file.peek(4) == "RIFF") {
+		int r, c;
+		if (!DecodeAudio::readWavHeader(&file, &r, &c, &left)) {
+			qWarning("%s: unsupported WAV format", qPrintable(fname));
+			return false;
+		}
+		setFormat(r, c);
+	}
+
+	int frameBytes = 2 * channels;
+	QByteArray buf;
+	buf.resize(READ_FRAMES * frameBytes);
+	int have = 0;
+	while (left) {
+		qint64 want = buf.size() - have;
+		if (left > 0)
+			want = qMin(want, left);
+		qint64 len = file.read(buf.data() + have, want);
+		if (len <= 0)
+			break;
+		if (left > 0)
+			left -= len;
+		len += have;
+		int n = len / frameBytes;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+		qint16 *p = (qint16 *)buf.data();
+		for (int i = 0; i < n * channels; i++)
+			p[i] = qFromLittleEndian(p[i]);
+#endif
+		process((const qint16 *)buf.constData(), n);
+
+		// A pipe can return part of a frame, it comes first next time
+		have = len - n * frameBytes;
+		memmove(buf.data(), buf.constData() + n * frameBytes, have);
+	}
+	flush();
+	return true;
+}
+
+
+/*!
+ * \brief The stream ended, decode what's left and finish all characters
+ *
+ * Afterwards \ref takeText() returns all text, even unfinished words.
+ */
+void Skimmer::flush()
+{
+	int hops = (fill - (proto.size() - hop)) / hop;
+	if (hops > 0)
+		runChunk(hops);
+	foreach(DecodeLevel *dec, decoders)
+		dec->flush();
+	flushed = true;
+}
+
+
+/*!
+ * \brief Returns the number of frames decoded
+ */
+qint64 Skimmer::frames() const
+{
+	return frameCount;
+}
+
+
+/*!
+ * \brief Return the decoded text of all signals, sorted by time
+ *
+ * Only finished words are returned, the rest comes next time. Text of
+ * channels that only hear a signal of the channel next to them is
+ * thrown away. That's decided for each word with the levels from when it
+ * was sent, so a signal that stopped long ago keeps it's text.
+ */
+QList<Skimmer::Spot> Skimmer::takeText()
+{
+	// The level of a hop belongs to the middle of the filter, not to it's start
+	qint64 delayMs = (qint64)proto.size() / 2 * 1000 / rate;
+	float width = (float)rate / fftLen;
+
+	QList<Spot> spots;
+	for (int b = 0; b < decoders.size(); b++) {
+		DecodeLevel *dec = decoders[b];
+		const QString &text = dec->text();
+		if (text.isEmpty() || (!flushed && !text.endsWith(' ')))
+			continue;
+
+		Spot spot;
+		spot.freq = qRound((firstBin + b) * width);
+		qint64 lastEnd = 0;
+		int i = 0;
+		while (i < text.size()) {
+			if (text.at(i) == ' ') {
+				i++;
+				continue;
+			}
+			// A space got the time when the word ended
+			int end = text.indexOf(' ', i);
+			if (end < 0)
+				end = text.size();
+			qint64 from = dec->charMs(i);
+			qint64 to = end < text.size() ? dec->charMs(end) : dec->ms();
+			if (isPeak(b, from, to)) {
+				if (!spot.text.isEmpty() && from - lastEnd > SPOT_PAUSE_MS) {
+					spots.append(spot);
+					spot.text.clear();
+				}
+				if (spot.text.isEmpty())
+					spot.ms = from + delayMs;
+				else
+					spot.text.append(' ');
+				spot.text.append(text.mid(i, end - i));
+				lastEnd = to;
+			}
+			i = end;
+		}
+		if (!spot.text.isEmpty())
+			spots.append(spot);
+	}
+
+	// The levels stay for the words that aren't finished yet, the text of
+	// the other channels is compared with them next time
+	qint64 keep = decoders.isEmpty() ? 0 : decoders.first()->ms() - KEEP_LEVELS_MS;
+	foreach(DecodeLevel *dec, decoders) {
+		const QString &text = dec->text();
+		if (!text.isEmpty() && (flushed || text.endsWith(' ')))
+			dec->takeText();
+		if (!dec->text().isEmpty())
+			keep = qMin(keep, dec->charMs(0));
+	}
+	foreach(DecodeLevel *dec, decoders)
+		dec->dropLevels(keep);
+
+	qSort(spots.begin(), spots.end(), spotBefore);
+	return spots;
+}
+
+
+/*!
+ * \brief Returns true if channel \a bin hears a signal of it's own
+ *
+ * From \a fromMs to \a toMs, in the time of the decoders. The channels
+ * are compared slot by slot of their level history, as another signal
+ * may come and go meanwhile. It must be a peak most of the time.
+ */
+bool Skimmer::isPeak(int bin, qint64 fromMs, qint64 toMs) const
+{
+	QVector<float> level(decoders.size());
+	int peaks = 0;
+	int count = 0;
+	for (qint64 ms = fromMs; ms <= toMs; ms += DecodeLevel::slotMs) {
+		for (int b = 0; b < decoders.size(); b++)
+			level[b] = decoders[b]->signalAt(ms);
+		if (ownSignal(level, bin, decoders[bin]->noiseAt(ms)))
+			peaks++;
+		count++;
+	}
+	return 2 * peaks > count;
+}
+
+
+/*!
+ * \brief Run the filter bank and the decoders over \a hops hops
+ */
+void Skimmer::runChunk(int hops)
+{
+	chunkHops = hops;
+	phase = Channelize;
+	pool.run((hops + SLICE - 1) / SLICE, this);
+	phase = Decode;
+	pool.run(decoders.size(), this);
+	warmup = qMax(warmup - hops, 0);
+
+	// Keep what the next chunk needs as history
+	int used = hops * hop;
+	memmove(input.data(), input.data() + used, (fill - used) * sizeof(float));
+	fill -= used;
+}
+
+
+/*!
+ * \brief Called by the \ref WorkPool workers
+ *
+ * First the hops are cut into slices, each job runs the filter bank over
+ * one slice. Then each job feeds the levels of one channel into it's
+ * decoder.
+ */
+void Skimmer::runJob(int job, int worker)
+{
+	if (phase == Channelize) {
+		float *re = scratch[worker].data();
+		float *im = re + fftLen;
+		int end = qMin(chunkHops, (job + 1) * SLICE);
+		for (int h = job * SLICE; h < end; h++)
+			channelize(h, re, im);
+		return;
+	}
+
+	DecodeLevel *dec = decoders[job];
+	const float *level = levels.constData() + job * CHUNK_HOPS;
+	for (int h = qMin(warmup, chunkHops); h < chunkHops; h++)
+		dec->level(level[h]);
+}
+
+
+/*!
+ * \brief Filter bank output number \a h of this chunk
+ *
+ * The input is weighted with the prototype filter and folded down to
+ * one FFT length. The FFT then gives all channels at once.
+ */
+void Skimmer::channelize(int h, float *re, float *im)
+{
+	const float *x = input.constData() + h * hop;
+	const float *c = proto.constData();
+
+	int m = 0;
+#if defined(__SSE2__)
+	for (; m + 4 <= fftLen; m += 4) {
+		__m128 acc = _mm_mul_ps(_mm_loadu_ps(c + m), _mm_loadu_ps(x + m));
+		for (int p = 1; p < TAPS; p++) {
+			int i = p * fftLen + m;
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(c + i), _mm_loadu_ps(x + i)));
+		}
+		_mm_storeu_ps(re + m, acc);
+	}
+#endif
+	for (; m < fftLen; m++) {
+		float acc = 0;
+		for (int p = 0; p < TAPS; p++)
+			acc += c[p * fftLen + m] * x[p * fftLen + m];
+		re[m] = acc;
+	}
+	memset(im, 0, fftLen * sizeof(float));
+
+	fft(re, im, fftLen, cosTab.constData(), sinTab.constData(), bitrev.constData());
+
+	float *out = levels.data() + h;
+	for (int b = 0; b < decoders.size(); b++) {
+		int k = firstBin + b;
+		out[b * CHUNK_HOPS] = sqrtf(re[k] * re[k] + im[k] * im[k]);
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef SKIMMER_H
+#define SKIMMER_H
+
+/**
+ * @file
+ * @author Holger Schurig, DH3HS
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "sinesource.h"
+#include "work_pool.h"
+
+
+class DecodeLevel;
+
+
+/*!
+ * \brief Decodes all morse signals in an audio band at once
+ *
+ * A polyphase filter bank cuts the band into narrow channels of about
+ * 100 Hz. Every channel has it's own \ref DecodeLevel, so every signal
+ * is decoded with it's own speed and level. A strong signal also shows
+ * up in the channels next to it, but only the loudest of them reports.
+ *
+ * The filter bank and the decoders run on all cores, in chunks of a few
+ * seconds. So it's made for recordings, not for live audio.
+ *
+ * Usage:
+ * \code
+ *   Skimmer skim;
+ *   skim.decodeFile("contest.wav");
+ *   foreach(const Skimmer::Spot &spot, skim.takeText())
+ *       printf("%lld ms %d Hz: %s\n", spot.ms, spot.freq, qPrintable(spot.text));
+ * \endcode
+ */
+class Skimmer : private WorkPool::Task {
+public:
+	/*!
+	 * \brief Words that one signal sent
+	 */
+	struct Spot {
+		qint64 ms;     //!< \brief Start of the first character
+		int freq;      //!< \brief Pitch of the signal in Hz
+		QString text;  //!< \brief Decoded text
+	};
+
+	Skimmer(int sampleRate=SAMPLE_RATE, int lowHz=300, int highHz=3500, int threads=0);
+	~Skimmer();
+	void setFormat(int sampleRate, int chans=1);
+	int sampleRate() const;
+	int binHz() const;
+
+	void process(const float *samples, int n);
+	void process(const qint16 *frames, int n);
+	bool decodeFile(const QString &fname);
+	void flush();
+	qint64 frames() const;
+
+	QList<Spot> takeText();
+
+private:
+	void setup();
+	void runChunk(int hops);
+	void runJob(int job, int worker);
+	void channelize(int hop, float *re, float *im);
+	bool isPeak(int bin, qint64 fromMs, qint64 toMs) const;
+
+	int rate;        //!< \brief Sample rate, see \ref setFormat()
+	int channels;    //!< \brief Channels of 16 bit frames, they get mixed to mono
+	int lowHz;       //!< \brief Lower edge of the band
+	int highHz;      //!< \brief Upper edge of the band
+	int fftLen;      //!< \brief Channels of the filter bank, a power of 2
+	int hop;         //!< \brief Samples from one filter bank output to the next
+	int firstBin;    //!< \brief FFT bin of the first decoder
+	QVector<float> proto;    //!< \brief Prototype low pass, \ref fftLen times the taps
+	QVector<float> cosTab;   //!< \brief Twiddle factors of the FFT
+	QVector<float> sinTab;   //!< \brief Twiddle factors of the FFT
+	QVector<int> bitrev;     //!< \brief Reordering of the FFT input
+	QVector<float> input;    //!< \brief Filter history plus the samples of this chunk
+	int fill;                //!< \brief Samples in \ref input
+	int warmup;              //!< \brief Hops until the filter history is real
+	QVector<float> levels;   //!< \brief Output of the filter bank, one row per decoder
+	QVector<QVector<float> > scratch; //!< \brief FFT buffers, one per worker
+	QList<DecodeLevel *> decoders;    //!< \brief One per channel in the band
+	qint64 frameCount;       //!< \brief See \ref frames()
+
+	WorkPool pool;
+	enum { Channelize, Decode } phase;  //!< \brief What \ref runJob() does
+	int chunkHops;           //!< \brief Hops in the chunk that \ref runJob() works on
+	bool flushed;            //!< \brief \ref flush() was called, there are no more samples
+};
+
+
+#endif
@@ -49,14 +49,16 @@ void MainWindow::slotCheck()
 	QString entry = morseEntry->toPlainText().simplified();
 	QString plain;
 
-	for (int i=0; i < entry.count(); i++) {
-		QString c = entry.mid(i,1);
-		if (c.at(0).isUpper()) {
-			c = entry.mid(i,2);
-			i++;
-		}
-		if (morse->exists(c))
-			plain.append(c);
+	Morse codes;
+	const QChar *text = entry.constData();
+	int len = entry.count();
+	while (len) {
+		int n;
+		int token = codes.matchToken(text, len, &n);
+		if (token >= 0)
+			plain.append(Morse::tokenSign(token));
+		text += n;
+		len -= n;
 	}
 
 	MYDEBUG("entered '%s'", qPrintable(plain));
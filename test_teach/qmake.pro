@@ -16,13 +16,26 @@ SOURCES *= $$TOPDIR/diff_match_patch.cpp
 
 SOURCES *= $$TOPDIR/morse.cpp
 HEADERS *= $$TOPDIR/morse.h
+SOURCES *= $$TOPDIR/morse_scheduler.cpp
+HEADERS *= $$TOPDIR/morse_scheduler.h
 SOURCES *= $$TOPDIR/audiooutput.cpp
 HEADERS *= $$TOPDIR/audiooutput.h
+SOURCES *= $$TOPDIR/audiomixer.cpp
+HEADERS *= $$TOPDIR/audiomixer.h
+SOURCES *= $$TOPDIR/audiosink.cpp
+HEADERS *= $$TOPDIR/audiosink.h
+SOURCES *= $$TOPDIR/render_morse.cpp
+HEADERS *= $$TOPDIR/render_morse.h
+SOURCES *= $$TOPDIR/impairment.cpp
+HEADERS *= $$TOPDIR/impairment.h
+SOURCES *= $$TOPDIR/sinesource.cpp
+HEADERS *= $$TOPDIR/sinesource.h
 SOURCES *= $$TOPDIR/teach_morse.cpp
 HEADERS *= $$TOPDIR/teach_morse.h
 
 SOURCES *= $$TOPDIR/parse_csv.cpp
 MVG_YAML = $$TOPDIR/characters.yaml
+MORSE_TABLE = $$TOPDIR/characters.csv
 
 SOURCES *= mainwindow.cpp
 HEADERS *= mainwindow.h
@@ -0,0 +1,156 @@
+#define DEBUGLVL 0
+#include "mydebug.h"
+
+/**
+ * @file
+ *
+ * @section DESCRIPTION
+ *
+ * Simple work-stealing thread pool for batch jobs.
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include "work_pool.h"
+
+#include <QThread>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+
+
+/*!
+ * \brief One worker of \ref WorkPool
+ */
+class WorkPoolThread : public QThread {
+public:
+	WorkPoolThread(WorkPool *p, int n) : pool(p), worker(n) {}
+protected:
+	void run();
+private:
+	WorkPool *pool;
+	int worker;
+};
+
+
+void WorkPoolThread::run()
+{
+	int job;
+	while (pool->next(worker, &job))
+		pool->task->runJob(job, worker);
+}
+
+
+/*!
+ * \brief Create a pool
+ *
+ * @param threads  number of workers, 0 for one per core
+ */
+WorkPool::WorkPool(int threads)
+	: task(0)
+{
+	if (threads <= 0)
+		threads = QThread::idealThreadCount();
+	if (threads <= 0)
+		threads = 1;
+	for (int i = 0; i < threads; i++)
+		ranges.append(new Range);
+}
+
+
+WorkPool::~WorkPool()
+{
+	qDeleteAll(ranges);
+}
+
+
+/*!
+ * \brief Run jobs 0 to \a jobs - 1 and wait until all are done
+ */
+void WorkPool::run(int jobs, Task *t)
+{
+	MYTRACE("WorkPool::run(%d)", jobs);
+
+	task = t;
+	int n = ranges.size();
+	for (int i = 0; i < n; i++) {
+		Range *r = ranges[i];
+		r->lo = (qint64)jobs * i / n;
+		r->hi = (qint64)jobs * (i + 1) / n;
+		r->done = 0;
+		r->steals = 0;
+	}
+
+	QVector<WorkPoolThread *> threads;
+	for (int i = 0; i < n; i++) {
+		threads.append(new WorkPoolThread(this, i));
+		threads.last()->start();
+	}
+	foreach(WorkPoolThread *thread, threads) {
+		thread->wait();
+		delete thread;
+	}
+	task = 0;
+}
+
+
+/*!
+ * \brief Get the next job for \a worker
+ *
+ * @returns false when there's nothing left anywhere
+ */
+bool WorkPool::next(int worker, int *job)
+{
+	Range *r = ranges[worker];
+	do {
+		QMutexLocker lock(&r->mutex);
+		if (r->lo < r->hi) {
+			*job = r->lo++;
+			r->done++;
+			return true;
+		}
+	} while (steal(worker));
+	return false;
+}
+
+
+/*!
+ * \brief Move half of the jobs of some other worker to \a worker
+ *
+ * @returns false if all other workers are out of jobs, too
+ */
+bool WorkPool::steal(int worker)
+{
+	int n = ranges.size();
+	for (int i = 1; i < n; i++) {
+		Range *victim = ranges[(worker + i) % n];
+		int lo, hi;
+		{
+			QMutexLocker lock(&victim->mutex);
+			int left = victim->hi - victim->lo;
+			if (left <= 0)
+				continue;
+			lo = victim->hi - (left + 1) / 2;
+			hi = victim->hi;
+			victim->hi = lo;
+		}
+		MYVERBOSE("worker %d steals %d..%d", worker, lo, hi);
+		Range *r = ranges[worker];
+		QMutexLocker lock(&r->mutex);
+		r->lo = lo;
+		r->hi = hi;
+		r->steals++;
+		return true;
+	}
+	return false;
+}
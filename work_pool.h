@@ -0,0 +1,96 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+/**
+ * @file
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details at
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <QMutex>
+#include <QVector>
+
+
+class WorkPoolThread;
+
+
+/*!
+ * \brief Runs numbered jobs on all cores, with work stealing
+ *
+ * Every worker thread starts with an equal range of the job numbers and
+ * works through it from the front. A worker that runs out steals the back
+ * half of the range of another worker. So a few very long jobs don't leave
+ * the other workers idle.
+ *
+ * Usage:
+ * \code
+ *   class Render : public WorkPool::Task {
+ *   public:
+ *       void runJob(int job, int worker) { ... }
+ *   };
+ *   Render render;
+ *   WorkPool pool;
+ *   pool.run(jobCount, &render);
+ * \endcode
+ */
+class WorkPool {
+public:
+	/*!
+	 * \brief What the workers do
+	 */
+	class Task {
+	public:
+		virtual ~Task() {}
+		/*!
+		 * \brief Do job number \a job
+		 *
+		 * Called from the worker threads. \a worker is the number of
+		 * the calling worker, from 0 to \ref WorkPool::threads() - 1.
+		 * Use it to pick per-thread buffers.
+		 */
+		virtual void runJob(int job, int worker) = 0;
+	};
+
+	WorkPool(int threads=0);
+	~WorkPool();
+	/*! \brief Number of worker threads */
+	int threads() const { return ranges.size(); }
+	void run(int jobs, Task *task);
+
+	/*! \brief Jobs that worker \a n did in the last \ref run() */
+	int jobsDone(int n) const { return ranges.at(n)->done; }
+	/*! \brief How often worker \a n stole in the last \ref run() */
+	int steals(int n) const { return ranges.at(n)->steals; }
+private:
+	friend class WorkPoolThread;
+
+	/*!
+	 * \brief Job numbers a worker still has to do
+	 */
+	struct Range {
+		QMutex mutex;
+		int lo;      //!< \brief next job of the owner
+		int hi;      //!< \brief end of the range, thieves take from here
+		int done;    //!< \brief statistics
+		int steals;  //!< \brief statistics
+	};
+	bool next(int worker, int *job);
+	bool steal(int worker);
+
+	QVector<Range *> ranges;
+	Task *task;
+};
+
+
+#endif